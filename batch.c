@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_gpu.h"
+#include "gb_rom.h"
+#include "gb_fork.h"
+
+/*
+ *      Batch runner
+ *
+ *      Runs every ROM in a manifest headless and unthrottled, and prints a CSV
+ *      line of results for each: final frame hash, cycles run and wall time.
+ *
+ *      The core keeps the machine in globals, so every ROM runs in its own
+ *      forked instance (run_branches). Up to one runs per core at once and the
+ *      next ROM starts as soon as any finishes, so long ROMs don't hold up the
+ *      rest and a ROM that crashes the emulator only fails its own line.
+ *
+ *      Manifest lines are "<rom> <frames> [input script]", # starts a comment.
+ *      Input scripts are lines of "<frame> <buttons>", holding the buttons
+ *      (hex, key_press bits) from the start of that frame on.
+ */
+
+#define MAX_INPUTS 4096
+
+struct job {
+        char rom[256];
+        long frames;
+        char script[256];       // Empty for no input
+};
+
+struct result {
+        int status;             // 1 ok, 2 bad input, 0 crashed
+        uint64_t cycles;
+        uint64_t hash;
+        double ms;
+};
+
+struct job *jobs;
+int num_jobs = 0;
+struct result *results;
+bool boot_flag = true;
+
+/*
+ * Parse the manifest into jobs, returns -1 on error
+ */
+int
+read_manifest(char *filename)
+{
+        FILE *manifest = fopen(filename, "r");
+        if (manifest == NULL) {
+                fprintf(stderr, "Error opening manifest %s\n", filename);
+                return -1;
+        }
+
+        char line[600];
+        int capacity = 64;
+        jobs = malloc(capacity * sizeof(struct job));
+        if (jobs == NULL) {
+                fprintf(stderr, "Error allocating the job list\n");
+                fclose(manifest);
+                return -1;
+        }
+        while (fgets(line, sizeof(line), manifest)) {
+                if (line[0] == '#' || line[0] == '\n') {
+                        continue;
+                }
+                if (num_jobs == capacity) {
+                        capacity *= 2;
+                        struct job *grown = realloc(jobs, capacity * sizeof(struct job));
+                        if (grown == NULL) {
+                                fprintf(stderr, "Error allocating the job list\n");
+                                fclose(manifest);
+                                return -1;
+                        }
+                        jobs = grown;
+                }
+                struct job *job = &jobs[num_jobs];
+                job->script[0] = '\0';
+                if (sscanf(line, "%255s %ld %255s", job->rom, &job->frames, job->script) < 2) {
+                        fprintf(stderr, "Bad manifest line: %s", line);
+                        fclose(manifest);
+                        return -1;
+                }
+                num_jobs++;
+        }
+        fclose(manifest);
+        return 0;
+}
+
+/*
+ * Run a single ROM, called in the worker process
+ */
+void
+run_job(int index, void *arg, void *out)
+{
+        (void) arg;
+        struct job *job = &jobs[index];
+        struct result *result = out;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        // Input script
+        long input_frames[MAX_INPUTS];
+        unsigned input_buttons[MAX_INPUTS];
+        int num_inputs = 0;
+        if (job->script[0]) {
+                FILE *script = fopen(job->script, "r");
+                if (script == NULL) {
+                        result->status = 2;
+                        return;
+                }
+                while (num_inputs < MAX_INPUTS &&
+                       fscanf(script, "%ld %x", &input_frames[num_inputs], &input_buttons[num_inputs]) == 2) {
+                        num_inputs++;
+                }
+                fclose(script);
+        }
+
+        if (read_rom(job->rom, boot_flag) == -1) {
+                result->status = 2;
+                return;
+        }
+        init_cpu(load_rom, NULL, num_banks, cartridge_type, boot_flag);
+        init_gpu();
+
+        int next_input = 0;
+        for (long frame = 0; frame < job->frames; frame++) {
+                while (next_input < num_inputs && input_frames[next_input] <= frame) {
+                        set_buttons(input_buttons[next_input++]);
+                }
+                run_frame();
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        result->cycles = get_cycles();
+        result->hash = hash_frame();
+        result->ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        result->status = 1;
+}
+
+void
+usage()
+{
+    fprintf(stderr, "Usage: batch [-bh] [-j jobs] <manifest>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Skip boot rom.\n");
+    fprintf(stderr, "\t-j jobs    Number of ROMs run at once (default one per core).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+int
+main(int argc, char **argv)
+{
+        int workers = sysconf(_SC_NPROCESSORS_ONLN);
+        int c;
+        while ((c = getopt(argc, argv, "bj:h")) != -1) {
+                switch (c)
+                {
+                case 'b':       // Skipping boot rom
+                        boot_flag = false;
+                        break;
+                case 'j':       // Worker count
+                        workers = atoi(optarg);
+                        break;
+                default:
+                        usage();
+                        return -1;
+                }
+        }
+        if (optind == argc) {
+                usage();
+                return -1;
+        }
+        if (read_manifest(argv[optind]) == -1) {
+                return -1;
+        }
+        workers = MAX(workers, 1);
+
+        results = calloc(MAX(num_jobs, 1), sizeof(struct result));
+        if (results == NULL) {
+                fprintf(stderr, "Error allocating results\n");
+                return -1;
+        }
+        if (run_branches(num_jobs, workers, run_job, NULL, results, sizeof(struct result)) == -1) {
+                fprintf(stderr, "Error starting workers\n");
+                return -1;
+        }
+
+        printf("rom,frames,cycles,hash,ms,status\n");
+        int failures = 0;
+        for (int i = 0; i < num_jobs; i++) {
+                struct result *result = &results[i];
+                const char *status = result->status == 1 ? "ok" :
+                                     result->status == 2 ? "error" : "crashed";
+                printf("%s,%ld,%" PRIu64 ",%016" PRIx64 ",%.1f,%s\n", jobs[i].rom, jobs[i].frames,
+                       result->cycles, result->hash, result->ms, status);
+                failures += result->status != 1;
+        }
+        return failures ? 1 : 0;
+}
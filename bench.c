@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_gpu.h"
+#include "gb_rom.h"
+
+/*
+ *      Benchmark
+ *
+ *      Times the core alone on a ROM: every run powers on from scratch and
+ *      emulates the same number of frames as fast as possible. Prints each
+ *      run and the best and median, in frames per second and as a multiple
+ *      of real hardware speed (59.73 frames per second).
+ */
+
+#define MAX_RUNS 100
+
+bool boot_flag = true;
+long frame_count = 3600;
+int runs = 5;
+
+int
+compare_double(const void *a, const void *b)
+{
+        double x = *(const double *) a;
+        double y = *(const double *) b;
+        return (x > y) - (x < y);
+}
+
+void
+usage()
+{
+    fprintf(stderr, "Usage: bench [-bh] [-n frames] [-r runs] <filename>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Skip boot rom.\n");
+    fprintf(stderr, "\t-n frames  Frames per run (default 3600).\n");
+    fprintf(stderr, "\t-r runs    Number of runs (default 5).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+int
+main(int argc, char **argv)
+{
+        int c;
+        while ((c = getopt(argc, argv, "bn:r:h")) != -1) {
+                switch (c)
+                {
+                case 'b':       // Skipping boot rom
+                        boot_flag = false;
+                        break;
+                case 'n':       // Frames per run
+                        frame_count = atol(optarg);
+                        break;
+                case 'r':       // Run count
+                        runs = MIN(MAX(atoi(optarg), 1), MAX_RUNS);
+                        break;
+                default:
+                        usage();
+                        return -1;
+                }
+        }
+        if (optind == argc) {
+                usage();
+                return -1;
+        }
+        if (read_rom(argv[optind], boot_flag) == -1) {
+                printf("Error reading ROM\n");
+                return -1;
+        }
+
+        double fps[MAX_RUNS];
+        for (int run = 0; run < runs; run++) {
+                init_cpu(load_rom, NULL, num_banks, cartridge_type, boot_flag);
+                init_gpu();
+
+                struct timespec start, end;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for (long frame = 0; frame < frame_count; frame++) {
+                        run_frame();
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end);
+
+                double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+                fps[run] = frame_count / seconds;
+                printf("run %d: %.0f fps (%.1fx) hash %016" PRIx64 "\n", run + 1, fps[run],
+                       fps[run] / 59.73, hash_frame());
+        }
+
+        qsort(fps, runs, sizeof(double), compare_double);
+        printf("best %.0f fps (%.1fx), median %.0f fps (%.1fx)\n", fps[runs - 1], fps[runs - 1] / 59.73,
+               fps[runs / 2], fps[runs / 2] / 59.73);
+        return 0;
+}
@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "gb_gpu.h"
+#include "gb_env.h"
+
+/*
+ *      Stepping API check
+ *
+ *      Opens a ROM, runs it, then opens it again in the same process and
+ *      runs it the same way. A reopened environment has to power on exactly
+ *      like a fresh one, so both runs must end on the same frame hash and
+ *      cycle count. Exits with 0 when they do, 1 when they don't and 2 if the
+ *      ROM can't be opened.
+ */
+
+int
+main(int argc, char **argv)
+{
+        if (argc < 2 || argc > 3) {
+                fprintf(stderr, "Usage: envcheck <rom> [frames]\n");
+                return 2;
+        }
+        int frames = argc == 3 ? atoi(argv[2]) : 300;
+
+        uint64_t hashes[2], cycles[2];
+        for (int run = 0; run < 2; run++) {
+                if (env_open(argv[1], 0) == -1) {
+                        fprintf(stderr, "Error opening %s\n", argv[1]);
+                        return 2;
+                }
+                env_step(0, frames);
+                hashes[run] = hash_frame();
+                cycles[run] = env_cycles();
+        }
+        env_close();
+
+        if (hashes[0] != hashes[1] || cycles[0] != cycles[1]) {
+                printf("Reopened run differs: hash %016" PRIx64 " then %016" PRIx64 ", cycles %" PRIu64 " then %" PRIu64 "\n",
+                       hashes[0], hashes[1], cycles[0], cycles[1]);
+                return 1;
+        }
+        printf("Both runs end on %016" PRIx64 " after %" PRIu64 " cycles\n", hashes[0], cycles[0]);
+        return 0;
+}
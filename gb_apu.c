@@ -0,0 +1,677 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_apu.h"
+
+/*
+ *      Audio processing unit
+ *
+ *      The APU is not stepped per instruction. Cycles are accumulated in
+ *      apu_pending and the channels are caught up in one batch on register
+ *      access, at VBlank, or once APU_BATCH_CYCLES have built up. Samples are
+ *      pushed into a single producer / single consumer ring that the audio
+ *      device drains from its own thread, so neither side ever waits.
+ *
+ *      Channels are stepped from one waveform change to the next rather than
+ *      per cycle. Each change in a channel's output is added to the output
+ *      buffers as a band-limited step (a windowed sinc integrated over time,
+ *      picked from a table by the sub-sample position), panned by NR51, and
+ *      the buffers are integrated into samples at the host rate. Only the
+ *      steps cost anything, and there is no aliasing from the ~1 MHz output.
+ *
+ *      The sound registers live in IOR[0x10 - 0x3F] like every other I/O
+ *      register, this file only keeps the internal channel state.
+ */
+
+#define CPU_FREQ 4194304
+#define BLIP_TAPS 16            // Kernel width in output samples
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)      // Sub-sample positions
+#define BLIP_SIZE 1024          // Output samples per batch, plus kernel tails
+
+typedef float v4sf __attribute__ ((vector_size (16)));
+
+// Band-limited synthesis buffers
+struct blip_state {
+        uint64_t factor;        // Output samples per cycle, 32.32 fixed point
+        uint64_t offset;        // Sub-sample position of the batch start
+        float left[BLIP_SIZE + BLIP_TAPS + 1];  // Output changes
+        float right[BLIP_SIZE + BLIP_TAPS + 1];
+        float sum_left;         // Integrated output
+        float sum_right;
+        float hp_left;          // High pass filter charge
+        float hp_right;
+        int out_left[4];        // Last contribution of each channel
+        int out_right[4];
+};
+
+struct apu_state apu;            // Saved with the machine state
+struct blip_state blip;
+uint32_t apu_pending = 0;
+int apu_rate = 0;               // Host sample rate, 0 when there is no output
+double apu_ratio = 1.0;         // Rate control adjustment
+
+// Step kernels for each sub-sample phase
+v4sf blip_kernel[BLIP_PHASES][BLIP_TAPS / 4];
+
+// Output ring, written by the emulation thread and read by the audio device
+int16_t audio_ring[AUDIO_RING_SIZE][2];
+_Atomic uint32_t audio_head = 0;
+_Atomic uint32_t audio_tail = 0;
+int16_t audio_last[2];          // Repeated when the ring runs dry
+long audio_dropped = 0;
+
+// Square duty patterns, 12.5%, 25%, 50% and 75%
+uint8_t duty_table[4] = {0x01, 0x81, 0x87, 0x7E};
+
+// Bits that read back as 1 for 0xFF10 - 0xFF2F
+uint8_t apu_read_mask[0x20] = {
+        0x80, 0x3F, 0x00, 0xFF, 0xBF, 0xFF, 0x3F, 0x00,
+        0xFF, 0xBF, 0x7F, 0xFF, 0x9F, 0xFF, 0xBF, 0xFF,
+        0xFF, 0x00, 0x00, 0xBF, 0x00, 0x00, 0x70, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+/*
+ * Initialize the APU from the current sound registers
+ */
+void
+init_apu()
+{
+        memset(&apu, 0, sizeof(apu));
+        apu.power = IOR[0x26] & 0x80;
+        apu.seq_timer = 8192;
+        apu.ch4.lfsr = 0x7FFF;
+        apu_pending = 0;
+}
+
+/*
+ * Build the band-limited step kernels, Blackman windowed sinc with the
+ * cutoff just under the output Nyquist frequency
+ */
+static void
+init_kernels()
+{
+        for (int phase = 0; phase < BLIP_PHASES; phase++) {
+                float taps[BLIP_TAPS];
+                double sum = 0;
+                for (int i = 0; i < BLIP_TAPS; i++) {
+                        double x = i - BLIP_TAPS / 2 + 1 - (double) phase / BLIP_PHASES;
+                        double w = (x + BLIP_TAPS / 2) / BLIP_TAPS;
+                        double window = 0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+                        double sinc = x == 0 ? 1 : sin(M_PI * 0.9 * x) / (M_PI * 0.9 * x);
+                        taps[i] = window * sinc;
+                        sum += taps[i];
+                }
+                // Each step must add up to exactly its size
+                for (int i = 0; i < BLIP_TAPS; i++) {
+                        blip_kernel[phase][i / 4][i % 4] = taps[i] / sum;
+                }
+        }
+}
+
+/*
+ * Set the host sample rate, 0 runs the APU without producing audio
+ */
+void
+apu_set_output(int sample_rate)
+{
+        apu_sync();
+        memset(&blip, 0, sizeof(blip));
+        init_kernels();
+        apu_rate = MIN(sample_rate, 192000);
+        apu_set_rate_control(apu_ratio);
+}
+
+/*
+ * Dynamic rate control, produce ratio times the nominal number of samples.
+ * Lets the frontend hold the audio buffer level without audible pitch change
+ */
+void
+apu_set_rate_control(double ratio)
+{
+        apu_ratio = MAX(MIN(ratio, 1.005), 0.995);
+        blip.factor = (uint64_t) (apu_rate * apu_ratio * 4294967296.0 / CPU_FREQ);
+}
+
+/*
+ * Frequency timer periods
+ */
+static uint16_t
+square_period(uint8_t nr3, uint8_t nr4)
+{
+        return (2048 - (nr3 | ((nr4 & 0x7) << 8))) * 4;
+}
+
+static uint32_t
+noise_period()
+{
+        uint8_t divisor = IOR[0x22] & 0x7;
+        return (divisor ? divisor * 16 : 8) << (IOR[0x22] >> 4);
+}
+
+/*
+ * Channel 1 sweep frequency calculation, disables the channel on overflow
+ */
+static uint16_t
+sweep_calc()
+{
+        uint16_t delta = apu.ch1.sweep_freq >> (IOR[0x10] & 0x7);
+        uint16_t freq = (IOR[0x10] & 0x8) ? apu.ch1.sweep_freq - delta
+                                          : apu.ch1.sweep_freq + delta;
+        if (freq > 2047) {
+                apu.ch1.enabled = false;
+        }
+        return freq;
+}
+
+/*
+ * Envelope step shared by channels 1, 2 and 4
+ */
+static void
+envelope_step(uint8_t nr2, uint8_t *volume, uint8_t *timer)
+{
+        if (!(nr2 & 0x7)) {
+                return;
+        }
+        if (--(*timer) == 0) {
+                *timer = nr2 & 0x7;
+                if ((nr2 & 0x8) && *volume < 15) {
+                        (*volume)++;
+                }
+                else if (!(nr2 & 0x8) && *volume > 0) {
+                        (*volume)--;
+                }
+        }
+}
+
+/*
+ * Frame sequencer, clocked at 512 Hz
+ */
+static void
+sequencer_step()
+{
+        // Length counters on even steps
+        if (!(apu.seq_step & 0x1)) {
+                if ((IOR[0x14] & 0x40) && apu.ch1.length && --apu.ch1.length == 0)
+                        apu.ch1.enabled = false;
+                if ((IOR[0x19] & 0x40) && apu.ch2.length && --apu.ch2.length == 0)
+                        apu.ch2.enabled = false;
+                if ((IOR[0x1E] & 0x40) && apu.ch3.length && --apu.ch3.length == 0)
+                        apu.ch3.enabled = false;
+                if ((IOR[0x23] & 0x40) && apu.ch4.length && --apu.ch4.length == 0)
+                        apu.ch4.enabled = false;
+        }
+
+        // Sweep on steps 2 and 6
+        if ((apu.seq_step & 0x3) == 2 && --apu.ch1.sweep_timer == 0) {
+                apu.ch1.sweep_timer = (IOR[0x10] >> 4) & 0x7;
+                if (apu.ch1.sweep_timer == 0) {
+                        apu.ch1.sweep_timer = 8;
+                }
+                if (apu.ch1.sweep_enabled && (IOR[0x10] & 0x70)) {
+                        uint16_t freq = sweep_calc();
+                        if (freq <= 2047 && (IOR[0x10] & 0x7)) {
+                                apu.ch1.sweep_freq = freq;
+                                IOR[0x13] = freq & 0xFF;
+                                IOR[0x14] = (IOR[0x14] & ~0x7) | (freq >> 8);
+                                sweep_calc();
+                        }
+                }
+        }
+
+        // Envelopes on step 7
+        if (apu.seq_step == 7) {
+                envelope_step(IOR[0x12], &apu.ch1.volume, &apu.ch1.env_timer);
+                envelope_step(IOR[0x17], &apu.ch2.volume, &apu.ch2.env_timer);
+                envelope_step(IOR[0x21], &apu.ch4.volume, &apu.ch4.env_timer);
+        }
+
+        apu.seq_step = (apu.seq_step + 1) & 0x7;
+}
+
+/*
+ * Push a batch of stereo frames, dropping what doesn't fit if the audio
+ * device has fallen behind
+ */
+static void
+push_samples(int16_t (*frames)[2], uint32_t count)
+{
+        uint32_t head = atomic_load_explicit(&audio_head, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&audio_tail, memory_order_acquire);
+        uint32_t space = AUDIO_RING_SIZE - (head - tail);
+        if (count > space) {
+                audio_dropped += count - space;
+                count = space;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+                audio_ring[(head + i) & (AUDIO_RING_SIZE - 1)][0] = frames[i][0];
+                audio_ring[(head + i) & (AUDIO_RING_SIZE - 1)][1] = frames[i][1];
+        }
+        atomic_store_explicit(&audio_head, head + count, memory_order_release);
+}
+
+/*
+ * Analog output of a channel, -15 to 15 or 0 when its DAC is off
+ */
+static int
+channel_amp(int ch)
+{
+        uint8_t digital;
+        switch (ch) {
+                case 0:
+                if (!(IOR[0x12] & 0xF8))
+                        return 0;
+                digital = apu.ch1.enabled &&
+                          ((duty_table[IOR[0x11] >> 6] >> (7 - apu.ch1.duty_pos)) & 0x1) ? apu.ch1.volume : 0;
+                break;
+                case 1:
+                if (!(IOR[0x17] & 0xF8))
+                        return 0;
+                digital = apu.ch2.enabled &&
+                          ((duty_table[IOR[0x16] >> 6] >> (7 - apu.ch2.duty_pos)) & 0x1) ? apu.ch2.volume : 0;
+                break;
+                case 2:
+                if (!(IOR[0x1A] & 0x80))
+                        return 0;
+                digital = 0;
+                if (apu.ch3.enabled && ((IOR[0x1C] >> 5) & 0x3)) {
+                        uint8_t sample = IOR[0x30 + (apu.ch3.pos >> 1)];
+                        sample = (apu.ch3.pos & 0x1) ? sample & 0xF : sample >> 4;
+                        digital = sample >> (((IOR[0x1C] >> 5) & 0x3) - 1);
+                }
+                break;
+                default:
+                if (!(IOR[0x21] & 0xF8))
+                        return 0;
+                digital = apu.ch4.enabled && !(apu.ch4.lfsr & 0x1) ? apu.ch4.volume : 0;
+                break;
+        }
+        return 2 * digital - 15;
+}
+
+/*
+ * Add a band-limited step of the given size at a cycle within the current batch
+ */
+static void
+add_step(uint32_t time, int delta_left, int delta_right)
+{
+        uint64_t pos = blip.offset + time * blip.factor;
+        uint32_t index = pos >> 32;
+        uint32_t phase = (pos >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+        v4sf *kernel = blip_kernel[phase];
+        float *left = &blip.left[index];
+        float *right = &blip.right[index];
+
+        // Four lanes at a time, the buffers are not aligned to the step
+        for (int i = 0; i < BLIP_TAPS / 4; i++) {
+                v4sf l, r;
+                memcpy(&l, left + 4 * i, sizeof(l));
+                memcpy(&r, right + 4 * i, sizeof(r));
+                l += kernel[i] * (float) delta_left;
+                r += kernel[i] * (float) delta_right;
+                memcpy(left + 4 * i, &l, sizeof(l));
+                memcpy(right + 4 * i, &r, sizeof(r));
+        }
+}
+
+/*
+ * Re-mix a channel after its output may have changed, panned by NR51 and
+ * scaled by NR50. Only actual changes reach the output buffers
+ */
+static void
+update_output(int ch, uint32_t time)
+{
+        int amp = channel_amp(ch);
+        int left = (IOR[0x25] & (0x10 << ch)) ? amp * (((IOR[0x24] >> 4) & 0x7) + 1) : 0;
+        int right = (IOR[0x25] & (0x1 << ch)) ? amp * ((IOR[0x24] & 0x7) + 1) : 0;
+        if (left != blip.out_left[ch] || right != blip.out_right[ch]) {
+                add_step(time, left - blip.out_left[ch], right - blip.out_right[ch]);
+                blip.out_left[ch] = left;
+                blip.out_right[ch] = right;
+        }
+}
+
+static void
+update_outputs(uint32_t time)
+{
+        for (int ch = 0; ch < 4; ch++) {
+                update_output(ch, time);
+        }
+}
+
+/*
+ * Run the channel frequency timers over len cycles starting at start. Work
+ * is done per waveform step, not per cycle, and silent squares are skipped
+ */
+static void
+run_channels(uint32_t start, uint32_t len)
+{
+        uint32_t t;
+        uint32_t period;
+
+        // Square 1
+        period = square_period(IOR[0x13], IOR[0x14]);
+        t = apu.ch1.timer;
+        if (t <= len && (!apu.ch1.enabled || !(IOR[0x12] & 0xF8))) {
+                uint32_t steps = (len - t) / period + 1;
+                apu.ch1.duty_pos = (apu.ch1.duty_pos + steps) & 0x7;
+                t += steps * period;
+        }
+        for (; t <= len; t += period) {
+                apu.ch1.duty_pos = (apu.ch1.duty_pos + 1) & 0x7;
+                update_output(0, start + t);
+        }
+        apu.ch1.timer = t - len;
+
+        // Square 2
+        period = square_period(IOR[0x18], IOR[0x19]);
+        t = apu.ch2.timer;
+        if (t <= len && (!apu.ch2.enabled || !(IOR[0x17] & 0xF8))) {
+                uint32_t steps = (len - t) / period + 1;
+                apu.ch2.duty_pos = (apu.ch2.duty_pos + steps) & 0x7;
+                t += steps * period;
+        }
+        for (; t <= len; t += period) {
+                apu.ch2.duty_pos = (apu.ch2.duty_pos + 1) & 0x7;
+                update_output(1, start + t);
+        }
+        apu.ch2.timer = t - len;
+
+        // Wave
+        period = square_period(IOR[0x1D], IOR[0x1E]) / 2;
+        t = apu.ch3.timer;
+        if (t <= len && !apu.ch3.enabled) {
+                uint32_t steps = (len - t) / period + 1;
+                apu.ch3.pos = (apu.ch3.pos + steps) & 0x1F;
+                t += steps * period;
+        }
+        for (; t <= len; t += period) {
+                apu.ch3.pos = (apu.ch3.pos + 1) & 0x1F;
+                update_output(2, start + t);
+        }
+        apu.ch3.timer = t - len;
+
+        // Noise
+        period = noise_period();
+        for (t = apu.ch4.timer; t <= len; t += period) {
+                uint16_t bit = (apu.ch4.lfsr ^ (apu.ch4.lfsr >> 1)) & 0x1;
+                apu.ch4.lfsr = (apu.ch4.lfsr >> 1) | (bit << 14);
+                if (IOR[0x22] & 0x8) {
+                        apu.ch4.lfsr = (apu.ch4.lfsr & ~0x40) | (bit << 6);
+                }
+                update_output(3, start + t);
+        }
+        apu.ch4.timer = t - len;
+}
+
+/*
+ * Turn the steps added over a batch of cycles into samples for the ring
+ */
+static void
+flush_samples(uint32_t cycles)
+{
+        uint64_t end = blip.offset + cycles * blip.factor;
+        uint32_t count = end >> 32;
+        int16_t out[BLIP_SIZE][2];
+
+        for (uint32_t i = 0; i < count; i++) {
+                blip.sum_left += blip.left[i];
+                blip.sum_right += blip.right[i];
+
+                // Remove the DC offset like the capacitor on the real output
+                float left = blip.sum_left - blip.hp_left;
+                float right = blip.sum_right - blip.hp_right;
+                blip.hp_left = blip.sum_left - left * 0.996f;
+                blip.hp_right = blip.sum_right - right * 0.996f;
+
+                // Full scale is 4 channels * 15 * 8 volume steps
+                out[i][0] = MAX(MIN(left * 64, 32767), -32768);
+                out[i][1] = MAX(MIN(right * 64, 32767), -32768);
+        }
+        push_samples(out, count);
+
+        // Keep the kernel tails that reach past the last sample
+        memmove(blip.left, blip.left + count, (BLIP_TAPS + 1) * sizeof(float));
+        memmove(blip.right, blip.right + count, (BLIP_TAPS + 1) * sizeof(float));
+        memset(blip.left + BLIP_TAPS + 1, 0, count * sizeof(float));
+        memset(blip.right + BLIP_TAPS + 1, 0, count * sizeof(float));
+        blip.offset = end & 0xFFFFFFFF;
+}
+
+/*
+ * Run the APU for all pending cycles
+ */
+void
+apu_sync()
+{
+        uint32_t cycles = apu_pending;
+        apu_pending = 0;
+
+        while (cycles) {
+                // Bounded so a batch always fits the output buffer
+                uint32_t chunk = MIN(cycles, APU_BATCH_CYCLES);
+                uint32_t done = 0;
+                cycles -= chunk;
+
+                while (done < chunk) {
+                        uint32_t len = MIN(chunk - done, apu.seq_timer);
+                        if (apu_rate && apu.power) {
+                                run_channels(done, len);
+                        }
+                        done += len;
+                        apu.seq_timer -= len;
+                        if (apu.seq_timer == 0) {
+                                apu.seq_timer = 8192;
+                                if (apu.power) {
+                                        sequencer_step();
+                                        if (apu_rate)
+                                                update_outputs(done);
+                                }
+                        }
+                }
+
+                // Without an output device only the frame sequencer matters
+                if (apu_rate) {
+                        flush_samples(chunk);
+                }
+        }
+}
+
+/*
+ * Restart a channel when bit 7 of NRx4 is written
+ */
+static void
+trigger(uint8_t channel)
+{
+        switch (channel) {
+                case 1:
+                apu.ch1.enabled = IOR[0x12] & 0xF8;
+                if (apu.ch1.length == 0)
+                        apu.ch1.length = 64;
+                apu.ch1.timer = square_period(IOR[0x13], IOR[0x14]);
+                apu.ch1.volume = IOR[0x12] >> 4;
+                apu.ch1.env_timer = IOR[0x12] & 0x7;
+                apu.ch1.sweep_freq = IOR[0x13] | ((IOR[0x14] & 0x7) << 8);
+                apu.ch1.sweep_timer = (IOR[0x10] >> 4) & 0x7;
+                if (apu.ch1.sweep_timer == 0)
+                        apu.ch1.sweep_timer = 8;
+                apu.ch1.sweep_enabled = IOR[0x10] & 0x77;
+                if (IOR[0x10] & 0x7)
+                        sweep_calc();
+                break;
+                case 2:
+                apu.ch2.enabled = IOR[0x17] & 0xF8;
+                if (apu.ch2.length == 0)
+                        apu.ch2.length = 64;
+                apu.ch2.timer = square_period(IOR[0x18], IOR[0x19]);
+                apu.ch2.volume = IOR[0x17] >> 4;
+                apu.ch2.env_timer = IOR[0x17] & 0x7;
+                break;
+                case 3:
+                apu.ch3.enabled = IOR[0x1A] & 0x80;
+                if (apu.ch3.length == 0)
+                        apu.ch3.length = 256;
+                apu.ch3.timer = square_period(IOR[0x1D], IOR[0x1E]) / 2;
+                apu.ch3.pos = 0;
+                break;
+                case 4:
+                apu.ch4.enabled = IOR[0x21] & 0xF8;
+                if (apu.ch4.length == 0)
+                        apu.ch4.length = 64;
+                apu.ch4.timer = noise_period();
+                apu.ch4.volume = IOR[0x21] >> 4;
+                apu.ch4.env_timer = IOR[0x21] & 0x7;
+                apu.ch4.lfsr = 0x7FFF;
+                break;
+        }
+}
+
+/*
+ * Read a sound register (0x10 - 0x3F)
+ */
+uint8_t
+apu_read(uint8_t reg)
+{
+        if (reg >= 0x30) {      // Wave RAM
+                return IOR[reg];
+        }
+        if (reg == 0x26) {      // NR52, channel status needs to be current
+                apu_sync();
+                return (apu.power ? 0x80 : 0) | apu_read_mask[0x16] |
+                       (apu.ch1.enabled ? 0x1 : 0) | (apu.ch2.enabled ? 0x2 : 0) |
+                       (apu.ch3.enabled ? 0x4 : 0) | (apu.ch4.enabled ? 0x8 : 0);
+        }
+        return IOR[reg] | apu_read_mask[reg - 0x10];
+}
+
+/*
+ * Write a sound register (0x10 - 0x3F), catching the APU up first
+ */
+void
+apu_write(uint8_t reg, uint8_t val)
+{
+        apu_sync();
+
+        if (reg >= 0x30) {      // Wave RAM
+                IOR[reg] = val;
+                return;
+        }
+        if (reg == 0x26) {      // NR52
+                apu.power = val & 0x80;
+                IOR[0x26] = val & 0x80;
+                if (!apu.power) {
+                        // Powering off clears every register
+                        memset(&IOR[0x10], 0, 0x16);
+                        apu.ch1.enabled = apu.ch2.enabled = false;
+                        apu.ch3.enabled = apu.ch4.enabled = false;
+                }
+                else {
+                        apu.seq_step = 0;
+                }
+                if (apu_rate) {
+                        update_outputs(0);
+                }
+                return;
+        }
+        if (!apu.power) {
+                return;
+        }
+
+        IOR[reg] = val;
+        switch (reg) {
+                case 0x11:      // NR11 length
+                apu.ch1.length = 64 - (val & 0x3F);
+                break;
+                case 0x16:      // NR21 length
+                apu.ch2.length = 64 - (val & 0x3F);
+                break;
+                case 0x1B:      // NR31 length
+                apu.ch3.length = 256 - val;
+                break;
+                case 0x20:      // NR41 length
+                apu.ch4.length = 64 - (val & 0x3F);
+                break;
+                case 0x12:      // DAC off disables the channel
+                if (!(val & 0xF8))
+                        apu.ch1.enabled = false;
+                break;
+                case 0x17:
+                if (!(val & 0xF8))
+                        apu.ch2.enabled = false;
+                break;
+                case 0x1A:
+                if (!(val & 0x80))
+                        apu.ch3.enabled = false;
+                break;
+                case 0x21:
+                if (!(val & 0xF8))
+                        apu.ch4.enabled = false;
+                break;
+                case 0x14:      // NRx4 trigger
+                if (val & 0x80)
+                        trigger(1);
+                break;
+                case 0x19:
+                if (val & 0x80)
+                        trigger(2);
+                break;
+                case 0x1E:
+                if (val & 0x80)
+                        trigger(3);
+                break;
+                case 0x23:
+                if (val & 0x80)
+                        trigger(4);
+                break;
+        }
+
+        // Volume, panning or a trigger take effect from here
+        if (apu_rate) {
+                update_outputs(0);
+        }
+}
+
+/*
+ * Copy up to frames stereo frames out of the ring (audio device thread).
+ * Missing samples are filled with the last one, returns the frames read
+ */
+int
+apu_read_samples(int16_t *out, int frames)
+{
+        uint32_t tail = atomic_load_explicit(&audio_tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&audio_head, memory_order_acquire);
+        int available = MIN((int) (head - tail), frames);
+
+        for (int i = 0; i < available; i++) {
+                out[2 * i] = audio_ring[(tail + i) & (AUDIO_RING_SIZE - 1)][0];
+                out[2 * i + 1] = audio_ring[(tail + i) & (AUDIO_RING_SIZE - 1)][1];
+        }
+        if (available > 0) {
+                audio_last[0] = out[2 * available - 2];
+                audio_last[1] = out[2 * available - 1];
+        }
+        for (int i = available; i < frames; i++) {
+                out[2 * i] = audio_last[0];
+                out[2 * i + 1] = audio_last[1];
+        }
+        atomic_store_explicit(&audio_tail, tail + available, memory_order_release);
+        return available;
+}
+
+/*
+ * Number of stereo frames waiting in the ring
+ */
+int
+apu_buffered()
+{
+        return atomic_load_explicit(&audio_head, memory_order_acquire) -
+               atomic_load_explicit(&audio_tail, memory_order_acquire);
+}
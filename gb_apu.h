@@ -0,0 +1,68 @@
+#include <unistd.h>
+
+/*
+ *      Function headers
+ */
+void init_apu();
+void apu_set_output(int sample_rate);
+void apu_set_rate_control(double ratio);
+uint8_t apu_read(uint8_t reg);
+void apu_write(uint8_t reg, uint8_t val);
+void apu_sync();
+int apu_read_samples(int16_t *out, int frames);
+int apu_buffered();
+
+/*
+ *      Channel state
+ */
+struct square {
+        bool enabled;
+        uint16_t timer;         // Cycles until next duty step
+        uint8_t duty_pos;
+        uint16_t length;
+        uint8_t volume;
+        uint8_t env_timer;
+        // Channel 1 sweep
+        bool sweep_enabled;
+        uint8_t sweep_timer;
+        uint16_t sweep_freq;    // Shadow frequency
+};
+
+struct wave {
+        bool enabled;
+        uint16_t timer;
+        uint8_t pos;            // Sample index 0 - 31
+        uint16_t length;
+};
+
+struct noise {
+        bool enabled;
+        uint32_t timer;
+        uint16_t lfsr;
+        uint16_t length;
+        uint8_t volume;
+        uint8_t env_timer;
+};
+
+struct apu_state {
+        bool power;
+        struct square ch1;
+        struct square ch2;
+        struct wave ch3;
+        struct noise ch4;
+        uint16_t seq_timer;     // Cycles until next frame sequencer step
+        uint8_t seq_step;
+};
+
+/*
+ *      Shared variables
+ */
+extern struct apu_state apu;
+extern uint32_t apu_pending;    // Cycles not yet run through the APU
+
+/*
+ *      Constants definitions
+ */
+#define APU_BATCH_CYCLES 8192   // Most cycles run before the APU catches up
+#define AUDIO_RING_SIZE 8192    // Stereo frames held for the audio device
+#define AUDIO_TARGET_FILL 2048  // Frames the frontend aims to keep buffered
@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "gb_gpu.h"
+#include "gb_capture.h"
+
+/*
+ *      Frame capture
+ *
+ *      Completed frames are packed to 2bpp and handed to a background writer
+ *      through a ring of slots, so a slow disk or encoder only stalls emulation
+ *      once the ring is full. No frame is ever dropped, the recording keeps
+ *      the timeline of the run. Identical consecutive frames are queued as
+ *      repeat markers without copying any pixel data. If the output fails
+ *      (a full disk, an encoder that exited) capture stops with an error.
+ *
+ *      Raw streams are a sequence of records: 'F' followed by a packed frame,
+ *      or 'R' to repeat the previous frame. Packed frames are 144 rows of 40
+ *      bytes, four pixels per byte with the leftmost pixel in the top bits.
+ *      RGB and y4m streams repeat the converted frame so encoders keep time.
+ */
+
+#define FRAME_BYTES (144 * 160 / 4)     // Packed 2bpp frame
+#define CAPTURE_SLOTS 256               // Frames buffered ahead of the writer
+
+struct capture_slot {
+        bool repeat;                    // Same as the previous frame
+        uint8_t data[FRAME_BYTES];
+};
+
+// Output stream
+FILE *capture_file;
+bool capture_pipe;              // Opened with popen
+int capture_type;
+bool capture_active = false;
+
+// Ring shared with the writer thread
+struct capture_slot *capture_ring;
+uint8_t *capture_converted;     // Writer's frame in the output format
+unsigned capture_head = 0;      // Next slot to fill (emulation thread)
+unsigned capture_tail = 0;      // Next slot to write (writer thread)
+bool capture_closing = false;
+bool capture_failed = false;    // Output error, the writer has stopped
+pthread_t capture_thread;
+pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t capture_ready = PTHREAD_COND_INITIALIZER;
+pthread_cond_t capture_space = PTHREAD_COND_INITIALIZER;
+
+// Emulation side bookkeeping
+uint8_t capture_last[FRAME_BYTES];      // Last frame queued
+bool capture_has_last = false;
+long capture_frames = 0;
+long capture_repeats = 0;
+
+// Greyscale level of each shade, matching the SDL palette
+uint8_t capture_shades[4] = {0xFF, 0xAA, 0x55, 0x00};
+
+/*
+ * Map a format name given on the command line to a capture format
+ */
+int
+parse_capture_format(char *name)
+{
+        if (strcmp(name, "raw") == 0)
+                return CAPTURE_RAW;
+        if (strcmp(name, "rgb") == 0)
+                return CAPTURE_RGB;
+        if (strcmp(name, "y4m") == 0)
+                return CAPTURE_Y4M;
+        return -1;
+}
+
+/*
+ * Convert a packed frame to the output format, returns the number of bytes
+ */
+static size_t
+convert_frame(uint8_t *packed, uint8_t *out)
+{
+        size_t len = 0;
+        for (int i = 0; i < FRAME_BYTES; i++) {
+                for (int shift = 6; shift >= 0; shift -= 2) {
+                        uint8_t level = capture_shades[(packed[i] >> shift) & 0x3];
+                        out[len++] = level;
+                        if (capture_type == CAPTURE_RGB) {
+                                out[len++] = level;
+                                out[len++] = level;
+                        }
+                }
+        }
+        return len;
+}
+
+/*
+ * Write one slot to the output, returns false if the output failed
+ */
+static bool
+write_slot(struct capture_slot *slot, uint8_t *converted, size_t *converted_len)
+{
+        if (capture_type == CAPTURE_RAW) {
+                if (slot->repeat) {
+                        return fputc('R', capture_file) != EOF;
+                }
+                return fputc('F', capture_file) != EOF &&
+                       fwrite(slot->data, FRAME_BYTES, 1, capture_file) == 1;
+        }
+        if (!slot->repeat || *converted_len == 0) {
+                *converted_len = convert_frame(slot->data, converted);
+        }
+        if (capture_type == CAPTURE_Y4M && fputs("FRAME\n", capture_file) == EOF) {
+                return false;
+        }
+        return fwrite(converted, *converted_len, 1, capture_file) == 1;
+}
+
+/*
+ * Writer thread, drains the ring until capture is closed or the output fails
+ */
+static void *
+capture_writer(void *arg)
+{
+        (void) arg;
+        size_t converted_len = 0;
+
+        pthread_mutex_lock(&capture_lock);
+        while (true) {
+                while (capture_tail == capture_head && !capture_closing) {
+                        pthread_cond_wait(&capture_ready, &capture_lock);
+                }
+                if (capture_tail == capture_head) {
+                        break;          // Closing and drained
+                }
+                struct capture_slot *slot = &capture_ring[capture_tail % CAPTURE_SLOTS];
+                pthread_mutex_unlock(&capture_lock);
+
+                // Writing happens outside the lock
+                bool written = write_slot(slot, capture_converted, &converted_len);
+                int error = errno;
+
+                pthread_mutex_lock(&capture_lock);
+                if (!written) {
+                        fprintf(stderr, "Capture output failed after %u frames: %s\n",
+                                capture_tail, strerror(error));
+                        capture_failed = true;
+                        pthread_cond_signal(&capture_space);
+                        break;
+                }
+                capture_tail++;
+                pthread_cond_signal(&capture_space);
+        }
+        pthread_mutex_unlock(&capture_lock);
+        return NULL;
+}
+
+/*
+ * Open the capture target ("-" for stdout, "|command" to pipe into a process)
+ * and start the writer thread. Call before printing anything when using stdout
+ */
+int
+init_capture(char *target, int format)
+{
+        capture_type = format;
+        capture_pipe = false;
+        if (strcmp(target, "-") == 0) {
+                // Keep the real stdout for frames, messages go to stderr
+                fflush(stdout);
+                capture_file = fdopen(dup(STDOUT_FILENO), "wb");
+                dup2(STDERR_FILENO, STDOUT_FILENO);
+        }
+        else if (target[0] == '|') {
+                capture_file = popen(target + 1, "w");
+                capture_pipe = true;
+        }
+        else {
+                capture_file = fopen(target, "wb");
+        }
+        if (capture_file == NULL) {
+                printf("Error opening capture output %s\n", target);
+                return -1;
+        }
+#ifdef SIGPIPE
+        // An encoder that exits shows up as a write error, not a signal
+        signal(SIGPIPE, SIG_IGN);
+#endif
+        setvbuf(capture_file, NULL, _IOFBF, 1 << 20);
+
+        if (capture_type == CAPTURE_Y4M) {
+                // 4194304 / 70224 frames per second
+                fprintf(capture_file, "YUV4MPEG2 W160 H144 F4194304:70224 Ip A1:1 Cmono\n");
+        }
+
+        capture_ring = malloc(CAPTURE_SLOTS * sizeof(struct capture_slot));
+        capture_converted = malloc(144 * 160 * 3);
+        if (capture_ring == NULL || capture_converted == NULL) {
+                printf("Error allocating capture buffers\n");
+                goto fail;
+        }
+        capture_head = capture_tail = 0;
+        capture_closing = false;
+        capture_failed = false;
+        capture_has_last = false;
+        capture_frames = capture_repeats = 0;
+        if (pthread_create(&capture_thread, NULL, capture_writer, NULL) != 0) {
+                printf("Error starting capture thread\n");
+                goto fail;
+        }
+        capture_active = true;
+        return 0;
+
+fail:
+        free(capture_ring);
+        free(capture_converted);
+        if (capture_pipe) {
+                pclose(capture_file);
+        }
+        else {
+                fclose(capture_file);
+        }
+        return -1;
+}
+
+/*
+ * Queue the frame in graphics_raw, called once per completed frame. Returns
+ * -1 once the output has failed
+ */
+int
+capture_frame()
+{
+        if (!capture_active) {
+                return 0;
+        }
+
+        // Wait for the writer when the ring is full, a recording has no gaps
+        pthread_mutex_lock(&capture_lock);
+        while (capture_head - capture_tail == CAPTURE_SLOTS && !capture_failed) {
+                pthread_cond_wait(&capture_space, &capture_lock);
+        }
+        bool failed = capture_failed;
+        pthread_mutex_unlock(&capture_lock);
+        if (failed) {
+                return -1;
+        }
+        capture_frames++;
+
+        // Packing directly into the free slot
+        struct capture_slot *slot = &capture_ring[capture_head % CAPTURE_SLOTS];
+        uint8_t *packed = slot->data;
+        uint8_t *pixel = &graphics_raw[0][0];
+        for (int i = 0; i < FRAME_BYTES; i++) {
+                packed[i] = (pixel[0] << 6) | (pixel[1] << 4) | (pixel[2] << 2) | pixel[3];
+                pixel += 4;
+        }
+
+        slot->repeat = capture_has_last && memcmp(packed, capture_last, FRAME_BYTES) == 0;
+        if (slot->repeat) {
+                capture_repeats++;
+        }
+        else {
+                memcpy(capture_last, packed, FRAME_BYTES);
+                capture_has_last = true;
+        }
+
+        pthread_mutex_lock(&capture_lock);
+        capture_head++;
+        pthread_cond_signal(&capture_ready);
+        pthread_mutex_unlock(&capture_lock);
+        return 0;
+}
+
+/*
+ * Flush all queued frames and close the output, returns -1 if any of it
+ * failed (for a pipe, also if the command exited with an error)
+ */
+int
+close_capture()
+{
+        if (!capture_active) {
+                return 0;
+        }
+        pthread_mutex_lock(&capture_lock);
+        capture_closing = true;
+        pthread_cond_signal(&capture_ready);
+        pthread_mutex_unlock(&capture_lock);
+        pthread_join(capture_thread, NULL);
+
+        int closed = capture_pipe ? pclose(capture_file) : fclose(capture_file);
+        if (closed != 0 && !capture_failed) {
+                fprintf(stderr, "Error closing capture output\n");
+                capture_failed = true;
+        }
+        free(capture_ring);
+        free(capture_converted);
+        capture_active = false;
+
+        if (verbose || capture_failed) {
+                fprintf(stderr, "Captured %ld frames (%ld repeats)%s\n",
+                        capture_frames, capture_repeats, capture_failed ? ", output failed" : "");
+        }
+        return capture_failed ? -1 : 0;
+}
+
+/*
+ * Stop capturing in a forked child, without touching the parent's writer.
+ * Only the forking thread survives fork, so the ring would never drain
+ */
+void
+detach_capture()
+{
+        capture_active = false;
+}
@@ -0,0 +1,17 @@
+#include <unistd.h>
+
+/*
+ * Capture formats
+ */
+#define CAPTURE_RAW 0           // Tagged 2bpp frames with repeat markers
+#define CAPTURE_RGB 1           // Packed 24-bit RGB frames
+#define CAPTURE_Y4M 2           // YUV4MPEG2 greyscale stream
+
+/*
+ * Function headers
+ */
+int parse_capture_format(char *name);
+int init_capture(char *target, int format);
+int capture_frame();
+int close_capture();
+void detach_capture();
@@ -1,6 +1,7 @@
 #include <stdio.h>
-#include <SDL.h>
-#include <SDL_audio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <math.h>
 #include <stdbool.h>
 #include <unistd.h>
@@ -8,6 +9,20 @@
 #include "main.h"
 #include "gb_cpu.h"
 #include "gb_gpu.h"
+#include "gb_apu.h"
+#include "gb_profile.h"
+#include "gb_sampler.h"
+#include "gb_timing.h"
+#include "gb_debug.h"
+#include "gb_movie.h"
+#include "gb_hash.h"
+#include "gb_trace.h"
+#include "gb_rom.h"
+#include "gb_state.h"
+
+// Verbosity
+int verbose = 0;
+
 /*
  *      Memory
  */
@@ -22,6 +37,13 @@ uint8_t HRAM[0x7F];     // High RAM
 
 uint8_t eram_bank;      // Switchable ERAM bank if any
 uint16_t bank_mask;     // Mask for smaller ROM sizes
+uint8_t mbc1_shift;     // Bits of RBANK1 used by MBC1, 4 on multicarts
+
+// Host memory behind each 256 byte page, NULL takes the slow path below
+uint8_t *read_map[0x100];
+uint8_t *write_map[0x100];
+uint8_t *fetch_ptr;             // read_map entry for fetch_page, NULL for the slow path
+uint8_t fetch_page;             // Page of the last opcode or operand fetch
 
 // Basic DMG boot rom
 uint8_t BIOS[0x100] = {
@@ -88,48 +110,21 @@ uint8_t CB_CYCLES[0x400] = {
  *      Registers
  */
 
-struct registers                      // 8-bit registers
-{
-        union {
-                struct {
-                        uint8_t f;
-                        uint8_t a;
-                };
-                uint16_t af;
-        };
-        union {
-                struct {
-                        uint8_t c;
-                        uint8_t b;
-                };
-                uint16_t bc;
-        };
-        union {
-                struct {
-                        uint8_t e;
-                        uint8_t d;
-                };
-                uint16_t de;
-        };
-        union {
-                struct {
-                        uint8_t l;
-                        uint8_t h;
-                };
-                uint16_t hl;
-        };
-};
-
 struct registers reg;           // Registers
 uint16_t PC;                    // Program counter
 uint16_t SP;                    // Stack pointer
 uint8_t opcode;                 // Current opcode
 long opcodes_run = 0;
+long frames_run = 0;            // Completed frames (VBlanks)
+uint64_t cycles_run = 0;        // Total clock cycles
 uint8_t cbcode;                 // Opcode for 2 byte operations
 uint8_t IME = 1;                    // Interrupt Master Flag
 uint8_t IE;                     // Interrupt Enable
 uint8_t IF;                     // Interrupt Flag
 uint8_t HALT;                   // HALT flag
+uint8_t ei_delay;               // EI waiting for the next instruction
+uint8_t halt_bug;               // Next opcode fetch doesn't advance PC
+uint8_t irq_pending;            // Interrupt work before the next instruction
 
 // MBC1 Mapper values
 int cartridge_mapper = 0;
@@ -144,8 +139,12 @@ uint16_t div_lower;             // Cycle count for div timer
 uint16_t tima_lower;            // Cycle count for tima timer
 uint16_t lcd_cycles;            // Cycle count for lcd timer
 uint16_t cpu_cycles;            // Tracks cycle count of current operation
+uint16_t dma_cycles;            // Cycles left in an OAM DMA transfer
 uint16_t tima_freq[] = {1024, 16, 64, 256};     // Timer frequencies
 
+// I/O other
+uint8_t joystick_flags = 0xFF; // Joystick bits for reading 0xFF00
+
 // Variables used during instructions
 uint8_t n;
 uint8_t n2;
@@ -157,6 +156,13 @@ uint32_t nnnn;
 void
 init_cpu(uint8_t *rom, uint8_t *save, int num_banks, int cartridge, bool boot)
 {
+        // Power on, nothing is left from a previous ROM
+        clear_state();
+        IME = 1;
+        RBANK1 = 1;
+        MBC3_cwrite = 1;
+        joystick_flags = 0xFF;
+
         // Save rom to self
         ROM = rom;
         // Loading in save
@@ -173,14 +179,9 @@ init_cpu(uint8_t *rom, uint8_t *save, int num_banks, int cartridge, bool boot)
         lcd_cycles = 0;
         eram_bank = 1;
 
-        // Setting up bank mask for reading
-        switch(num_banks) {
-                case 2: bank_mask = 0x1; break;
-                case 4: bank_mask = 0x3; break;
-                case 8: bank_mask = 0x7; break;
-                case 16: bank_mask = 0xF; break;
-                default: bank_mask = 0x1F;
-        }
+        // Bank numbers wrap at the ROM size, a power of two from read_rom
+        bank_mask = num_banks - 1;
+        mbc1_shift = rom_quirks & QUIRK_MBC1M ? 4 : 5;
         // Values used if boot rom is skipped
         if (boot == false) {
 
@@ -227,11 +228,125 @@ init_cpu(uint8_t *rom, uint8_t *save, int num_banks, int cartridge, bool boot)
                 IOR[0x50] = 1;
                 IE = 0x00;
         }
+
+        // Sound state follows the registers above
+        init_apu();
+        update_memory_map();
+        update_interrupts();
 }
 
-// Read and return memory that would be at given addr
-uint8_t
-read_mem(uint16_t addr)
+/*
+ * Recompute irq_pending, called whenever IE, IF, IME, HALT, ei_delay or
+ * halt_bug change so execute() tests a single flag per instruction
+ */
+void
+update_interrupts()
+{
+        irq_pending = ((IME || HALT) && (IE & IF & 0x1F)) || ei_delay || halt_bug;
+}
+
+// Set a request bit in IF
+void
+request_interrupt(uint8_t flag)
+{
+        IF |= flag;
+        update_interrupts();
+}
+
+/*
+ * Point each page of the memory map at the memory currently behind it. Pages
+ * left NULL (IO, OAM, disabled or RTC mapped ERAM, ROM writes, watchpoints)
+ * go through the switches in read_mem/write_mem. Called on any change to the
+ * banking registers, VBK or the boot ROM flag, and after loading a state
+ */
+void
+update_memory_map()
+{
+        memset(read_map, 0, sizeof(read_map));
+        memset(write_map, 0, sizeof(write_map));
+
+        // OAM DMA holds the bus, everything goes through the slow path
+        if (dma_cycles) {
+                fetch_ptr = NULL;
+                return;
+        }
+
+        // ROM, bank 0 and the switchable bank
+        uint8_t *lower = ROM + get_rom_bank0() * ROM_BANK_SIZE;
+        uint8_t *upper = ROM + get_rom_bank() * ROM_BANK_SIZE;
+        for (int page = 0x00; page < 0x80; page++) {
+                read_map[page] = (page < 0x40 ? lower : upper) + ((page & 0x3F) << 8);
+        }
+        if (!IOR[0x50]) {
+                read_map[0x00] = BIOS;
+        }
+
+        // VRAM, writes go to the bank selected by VBK
+        for (int page = 0x80; page < 0xA0; page++) {
+                read_map[page] = VRAM + ((page - 0x80) << 8);
+                write_map[page] = VRAM + ((page - 0x80) << 8) + (IOR[0x4F] & 0x1) * 0x2000;
+        }
+
+        // External RAM, only bank 0 of it exists, unmapped while disabled
+        bool ram_enabled = (RAMG & 0x0F) == 0x0A;
+        bool bank0 = (cartridge_mapper == 1 && (!(RMODE & 0x1) || !(RBANK2 & 0x3))) ||
+                     (cartridge_mapper == 3 && RBANK2 == 0);
+        for (int page = 0xA0; page < 0xC0; page++) {
+                if (cartridge_mapper == 0) {
+                        read_map[page] = ERAM + ((page - 0xA0) << 8);
+                }
+                else if (ram_enabled && bank0) {
+                        read_map[page] = ERAM + ((page - 0xA0) << 8);
+                        write_map[page] = read_map[page];
+                }
+        }
+
+        // WRAM and its echo up to OAM
+        for (int page = 0xC0; page < 0xFE; page++) {
+                read_map[page] = WRAM + ((page - (page < 0xE0 ? 0xC0 : 0xE0)) << 8);
+                write_map[page] = read_map[page];
+        }
+
+        // Watched pages stay on the slow path
+        for (int page = 0x00; page < 0x100; page++) {
+                if (debug_read_pages[page]) {
+                        read_map[page] = NULL;
+                }
+                if (debug_write_pages[page]) {
+                        write_map[page] = NULL;
+                }
+        }
+        fetch_ptr = read_map[fetch_page];
+}
+
+/*
+ * Start an OAM DMA transfer from source page. The 160 bytes are copied at
+ * once, which is safe because the CPU can't reach the source (or anything
+ * below IO) until the transfer would have finished
+ */
+static void
+start_dma(uint8_t source)
+{
+        // The map is empty while a transfer runs, so a restart goes byte
+        // by byte, as do unmapped sources (OAM, IO, watched pages)
+        uint8_t *page = read_map[source];
+        if (page) {
+                memcpy(OAM, page, sizeof(OAM));
+        }
+        else {
+                for (uint8_t i = 0; i < sizeof(OAM); i++) {
+                        OAM[i] = peek_mem((source << 8) + i);
+                }
+        }
+
+        // Counted from the end of the writing instruction
+        dma_cycles = DMA_CYCLES + cpu_cycles;
+        update_memory_map();
+}
+
+// Memory at addr for the unmapped pages, no hooks and no DMA lockout
+static uint8_t
+read_bus(uint16_t addr)
 {
         switch (addr & 0xF000) {
                 case 0x0000:
@@ -241,43 +356,13 @@ read_mem(uint16_t addr)
                 __attribute__ ((fallthrough));                                  // Might want to fix this
                 case 0x1000:
                 case 0x2000:
-                case 0x3000:    // Lower ROM
-                // ROM only
-                if (cartridge_mapper == 0) {
-                        return ROM[addr];
-                }
-                // MBC1, ROM bank X0
-                else if (cartridge_mapper == 1) {
-                        if (RMODE & 0x1) {
-                                return ROM[addr + ((RBANK2 & 0x3) << 5) * ROM_BANK_SIZE];
-                        }
-                        else {
-                                return ROM[addr];
-                        }                                                       // Check if doesn't go outside the stuff?
-                }
-                // MBC3, ROM bank 00
-                else if (cartridge_mapper == 3) {
-                        return ROM[addr];
-                }
-                break;
+                case 0x3000:    // Lower ROM, bank X0 on MBC1
+                return ROM[get_rom_bank0() * ROM_BANK_SIZE + addr];
                 case 0x4000:
                 case 0x5000:
                 case 0x6000:
                 case 0x7000:    // Upper ROM
-                // ROM only
-                if (cartridge_mapper == 0) {
-                        return ROM[addr];
-                }
-                // MBC1, ROM bank 01~7F
-                else if (cartridge_mapper == 1) {
-                        return ROM[addr - ROM_ADDR + 
-                                ((RBANK1 & bank_mask) + ((RBANK2 & 0x3) << 5) - 1) * 0x4000];          
-                }
-                // MBC3, ROM bank 01~7F
-                else if (cartridge_mapper == 3) {
-                        return ROM[addr - ROM_ADDR + (RBANK1 & 0x7F) * 0x4000];
-                }
-                break;
+                return ROM[get_rom_bank() * ROM_BANK_SIZE + (addr - ROM_BANK_SIZE)];
                 case 0x8000:
                 case 0x9000:   // VRAM
                 return VRAM[addr - VRAM_ADDR];
@@ -362,6 +447,8 @@ read_mem(uint16_t addr)
                                 break;
                                 case 0x0F:      // IF register
                                 return IF;
+                                case 0x10 ... 0x3F:     // Sound registers and wave RAM
+                                return apu_read(addr & 0xFF);
                                 case 0x40:      // LCDC
                                 return IOR[0x40];
                                 break;
@@ -418,14 +505,45 @@ read_mem(uint16_t addr)
         return 0xFF;
 }
 
-// Write val to memory that would be at addr
-void
-write_mem(uint16_t addr, uint8_t val)
+// Read and return memory that would be at given addr
+uint8_t
+read_mem(uint16_t addr)
+{
+        PROFILE_READ(addr);
+        uint8_t *page = read_map[addr >> 8];
+        if (page) {
+                return page[addr & 0xFF];
+        }
+        WATCH_READ(addr);
+        if (dma_cycles && addr < IOR_ADDR) {
+                return 0xFF;    // Bus held by OAM DMA, only IO and HRAM answer
+        }
+        return read_bus(addr);
+}
+
+/*
+ * Read for debuggers and harnesses: what the memory holds, even while OAM
+ * DMA holds the bus, without counting in the profile or tripping watchpoints
+ */
+uint8_t
+peek_mem(uint16_t addr)
+{
+        uint8_t *page = read_map[addr >> 8];
+        if (page) {
+                return page[addr & 0xFF];
+        }
+        return read_bus(addr);
+}
+
+// Write to the unmapped pages, no hooks and no DMA lockout
+static void
+write_bus(uint16_t addr, uint8_t val)
 {
         switch (addr & 0xF000) {
                 case 0x0000:
                 case 0x1000:    // RAM enable
                 RAMG = val;
+                update_memory_map();
                 break;
                 case 0x2000:
                 case 0x3000:    // ROM bank number
@@ -440,15 +558,18 @@ write_mem(uint16_t addr, uint8_t val)
                                 RBANK1 |= 0x1;
                         }
                 }
+                update_memory_map();
                 break;
                 case 0x4000:
                 case 0x5000:    // ROM bank number upper bits
                 RBANK2 = val;
+                update_memory_map();
                 break;
                 case 0x6000:
                 case 0x7000:    // Banking mode
                 if (cartridge_mapper == 1) {
                         RMODE = val;
+                        update_memory_map();
                 }
                 else if (cartridge_mapper == 3) {
                         if (MBC3_cwrite == 0x0 && val == 0x1) 
@@ -545,6 +666,10 @@ write_mem(uint16_t addr, uint8_t val)
                                 break;
                                 case 0x0F:      // IF register
                                 IF = val;
+                                update_interrupts();
+                                break;
+                                case 0x10 ... 0x3F:     // Sound registers and wave RAM
+                                apu_write(addr & 0xFF, val);
                                 break;
                                 case 0x40:      // LCDC
                                 IOR[0x40] = val;
@@ -566,11 +691,8 @@ write_mem(uint16_t addr, uint8_t val)
                                 IOR[0x45] = val;
                                 break;
                                 case 0x46:      // OAM DMA Transfer
-                                IOR[0x46] = val;                                // Does this require some bitwies opperations  
-                                for (uint8_t i = 0; i < 0xA0; i++) {            // TODO: check it doesn't exceed 0xDF?
-                                        OAM[i] = read_mem((val << 8) + i);
-                                }
-                                cpu_cycles += 160;  // DMA cycles
+                                IOR[0x46] = val;
+                                start_dma(val);
                                 break;
                                 case 0x47:      // BGP
                                 IOR[0x47] = val;
@@ -587,8 +709,13 @@ write_mem(uint16_t addr, uint8_t val)
                                 case 0x4B:      // WX
                                 IOR[0x4B] = val;
                                 break;
+                                case 0x4F:      // VBK
+                                IOR[0x4F] = val;
+                                update_memory_map();
+                                break;
                                 case 0x50:      // BOOT Rom
                                 IOR[0x50] = 1;
+                                update_memory_map();
                                 if (verbose) {
                                         printf("Exiting boot rom\n");
                                 }
@@ -599,77 +726,197 @@ write_mem(uint16_t addr, uint8_t val)
                         }
                 else if (addr < 0xFFFF) // HRAM
                         HRAM[addr - HRAM_ADDR] = val;
-                else if (addr == 0xFFFF)        // Interrupt Enable
+                else if (addr == 0xFFFF) {      // Interrupt Enable
                         IE = val;
+                        update_interrupts();
+                }
                 break;
         }
 }
 
+// Write val to memory that would be at addr
+void
+write_mem(uint16_t addr, uint8_t val)
+{
+        PROFILE_WRITE(addr);
+        TRACE_WRITE(addr, val);
+        uint8_t *page = write_map[addr >> 8];
+        if (page) {
+                page[addr & 0xFF] = val;
+                return;
+        }
+        WATCH_WRITE(addr);
+        if (dma_cycles && addr < IOR_ADDR) {
+                return;         // Bus held by OAM DMA
+        }
+        write_bus(addr, val);
+}
+
+// Write for debuggers, the counterpart of peek_mem
+void
+poke_mem(uint16_t addr, uint8_t val)
+{
+        uint8_t *page = write_map[addr >> 8];
+        if (page) {
+                page[addr & 0xFF] = val;
+                return;
+        }
+        write_bus(addr, val);
+}
+
 /*
- * Handle interrupts and execute a single opcode
+ * Host pointer to the 16-bit value at addr when both bytes are in one mapped
+ * page or in HRAM, NULL when it has to go through the byte path
  */
-uint8_t
-execute()                                                                         // TODO: fix references to (HL) to be accurate
-{                                                                               // TODO: still missing misc, rotates, bit opcodes (3.3.5, 3.3.6, 3.3.7)
-        
+static inline uint8_t *
+direct16(uint8_t **map, uint16_t *watched, uint16_t addr)
+{
+        if ((addr & 0xFF) == 0xFF) {
+                return NULL;
+        }
+        uint8_t *page = map[addr >> 8];
+        if (page) {
+                return page + (addr & 0xFF);
+        }
+        if (addr >= HRAM_ADDR && addr < 0xFFFE && !watched[0xFF]) {
+                return HRAM + (addr - HRAM_ADDR);       // Reachable during OAM DMA
+        }
+        return NULL;
+}
 
-        // Handle interrupts
-        if ((HALT || IME) && (IE & IF)) {         // Check for correspondings flags
-                // Exit halt
-                HALT = 0;
-                
-                // If interrupts are enables
-                if (IME) {
-                        IME = 0;
+// Little endian 16-bit read, the page is resolved once
+uint16_t
+read_mem16(uint16_t addr)
+{
+        uint8_t *direct = direct16(read_map, debug_read_pages, addr);
+        if (direct) {
+                PROFILE_READ(addr);
+                PROFILE_READ(addr + 1);
+                return direct[0] | (direct[1] << 8);
+        }
+        uint16_t val = read_mem(addr);
+        return val | (read_mem(addr + 1) << 8);
+}
+
+// Little endian 16-bit write, low byte first
+void
+write_mem16(uint16_t addr, uint16_t val)
+{
+        uint8_t *direct = direct16(write_map, debug_write_pages, addr);
+        if (direct) {
+                PROFILE_WRITE(addr);
+                PROFILE_WRITE(addr + 1);
+                TRACE_WRITE(addr, val & 0xFF);
+                TRACE_WRITE(addr + 1, val >> 8);
+                direct[0] = val & 0xFF;
+                direct[1] = val >> 8;
+                return;
+        }
+        write_mem(addr, val & 0xFF);
+        write_mem(addr + 1, val >> 8);
+}
 
-                        // Put PC on stack
-                        write_mem(--SP, PC >> 8);
-                        write_mem(--SP, PC & 0xFF);
+// Push onto the stack, high byte first as the CPU does
+void
+push16(uint16_t val)
+{
+        SP -= 2;
+        uint8_t *direct = direct16(write_map, debug_write_pages, SP);
+        if (direct) {
+                PROFILE_WRITE(SP + 1);
+                PROFILE_WRITE(SP);
+                TRACE_WRITE(SP + 1, val >> 8);
+                TRACE_WRITE(SP, val & 0xFF);
+                direct[1] = val >> 8;
+                direct[0] = val & 0xFF;
+                return;
+        }
+        write_mem(SP + 1, val >> 8);
+        write_mem(SP, val & 0xFF);
+}
 
-                        // Vblank
-                        if (IE & IF & 0x1) {
-                                PC = 0x40;
-                                IF &= ~(0x1);
-                        }
+uint16_t
+pop16()
+{
+        uint16_t val = read_mem16(SP);
+        SP += 2;
+        return val;
+}
 
-                        // LCD STAT
-                        else if (IE & IF & 0x2) {
-                                //if (verbose) printf("STAT interrupt\n");
-                                PC = 0x48;
-                                IF &= ~(0x2);
-                        }
+/*
+ * Fetch the byte at PC and advance it. The host pointer for PC's page is
+ * kept between fetches and only looked up again when PC moves to another
+ * page (jumps, calls, crossings), update_memory_map refreshes it on bank
+ * switches
+ */
+static inline uint8_t
+fetch8()
+{
+        if ((PC >> 8) != fetch_page) {
+                fetch_page = PC >> 8;
+                fetch_ptr = read_map[fetch_page];
+        }
+        if (fetch_ptr) {
+                PROFILE_READ(PC);
+                return fetch_ptr[PC++ & 0xFF];
+        }
+        return read_mem(PC++);
+}
 
-                        // Timer
-                        else if (IE & IF & 0x4) {
-                                //if (verbose) printf("Timer interrupt\n");
-                                PC = 0x50;
-                                IF &= ~(0x4);
-                        }
+// Little endian immediate operand
+static inline uint16_t
+fetch16()
+{
+        uint16_t val = fetch8();
+        return val | (fetch8() << 8);
+}
 
-                        // Serial
-                        else if (IE & IF & 0x8) {
-                                //if (verbose) printf("Serial interrupt\n");
-                                PC = 0x58;
-                                IF &= ~(0x8);
-                        }
+/*
+ * Handle interrupts and execute a single opcode
+ */
+uint8_t
+execute()                                                                         // TODO: fix references to (HL) to be accurate
+{                                                                               // TODO: still missing misc, rotates, bit opcodes (3.3.5, 3.3.6, 3.3.7)
+        
 
-                        // Joypad
-                        else if (IE & IF & 0x10) {
-                                if (verbose) printf("Joypad interrupt\n");
-                                PC = 0x60;
-                                IF &= ~(0x10);
+        // Interrupts, a delayed EI and the HALT bug, all behind one flag
+        bool repeat_fetch = false;
+        if (irq_pending) {
+                uint8_t requested = IE & IF & 0x1F;
+                if (requested && (IME || HALT)) {
+                        HALT = 0;
+                        if (IME) {
+                                // Lowest bit wins, VBlank first and joypad last
+                                int source = __builtin_ctz(requested);
+                                IME = 0;
+                                ei_delay = 0;
+                                IF &= ~(1 << source);
+                                update_interrupts();
+                                push16(PC);
+                                PC = 0x40 + source * 8;
+                                SAMPLER_CALL();
+                                return 20;
                         }
                 }
-        }                                                                       // Should I wait a cycle?
-
+                if (ei_delay) {         // Interrupts are taken after this instruction
+                        ei_delay = 0;
+                        IME = 1;
+                }
+                if (halt_bug) {
+                        halt_bug = 0;
+                        repeat_fetch = true;
+                }
+                update_interrupts();
+        }
 
         // Doing nothing if halted (4 cycles)
         if (HALT) {
                 return 4;
         }
 
-        // Read next opcode
-        opcode = read_mem(PC++);
+        // Read next opcode, read twice after the HALT bug
+        opcode = fetch8();
+        PC -= repeat_fetch;
         opcodes_run += 1;
 
         // Default cycle length of operation
@@ -680,9 +927,17 @@ execute()
                 printf("Opcode: %X, PC: %X\n", opcode, PC - 1);
         }
 
-        // Halting
+        // Halting, which with IME off and an interrupt already pending fails
+        // and makes the next opcode byte be read twice
         if (opcode == 0x76) {
-                HALT = 1;
+                if (!IME && (IE & IF & 0x1F)) {
+                        halt_bug = 1;
+                }
+                else {
+                        HALT = 1;
+                }
+                update_interrupts();
+                PROFILE_OP(opcode, cpu_cycles);
                 return cpu_cycles;                 // HALT
         }
         switch (opcode & 0xF0)
@@ -692,8 +947,8 @@ execute()
                         case 0x0:       // NOP
                         break;
                         case 0x1:       // LD BC, nn                            // TODO: little endian?
-                        reg.c = read_mem(PC++);
-                        reg.b = read_mem(PC++);
+                        reg.c = fetch8();
+                        reg.b = fetch8();
                         break;
                         case 0x2:       // LD (BC), A
                         write_mem(reg.bc, reg.a);
@@ -723,7 +978,7 @@ execute()
                         }
                         break;
                         case 0x6:       // LD B, n
-                        reg.b = read_mem(PC++);
+                        reg.b = fetch8();
                         break;
                         case 0x7:       // RLCA
                         reg.a = (reg.a >> 7) | (reg.a << 1);
@@ -738,10 +993,8 @@ execute()
                         }
                         break;
                         case 0x8:       // LD (nn),SP
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
-                        write_mem(nn, SP & 0xFF);
-                        write_mem(++nn, SP >> 8); 
+                        nn = fetch16();
+                        write_mem16(nn, SP);
                         break;
                         case 0x9:       // ADD HL, BC
                         nnnn = reg.hl + reg.bc;
@@ -782,7 +1035,7 @@ execute()
                         }
                         break;
                         case 0xE:       // LD C, n
-                        reg.c = read_mem(PC++);
+                        reg.c = fetch8();
                         break;
                         case 0xF:       // RRCA
                         reg.a = ((reg.a << 7) | (reg.a >> 1));
@@ -803,10 +1056,11 @@ execute()
                         case 0x0:       // STOP
                         (void) 0;
                         HALT = 1;
+                        update_interrupts();
                         break;
                         case 0x1:       // LD DE, nn 
-                        reg.e = read_mem(PC++);
-                        reg.d = read_mem(PC++);
+                        reg.e = fetch8();
+                        reg.d = fetch8();
                         break;
                         case 0x2:       // LD (DE), A
                         write_mem(reg.de, reg.a);
@@ -836,7 +1090,7 @@ execute()
                         }
                         break;
                         case 0x6:       // LD D, n
-                        reg.d = read_mem(PC++);
+                        reg.d = fetch8();
                         break;
                         case 0x7:       // RLA
                         n = reg.a;
@@ -852,7 +1106,7 @@ execute()
                         }
                         break;
                         case 0x8:       // JR n                                                                                 
-                        n_signed = (int8_t) read_mem(PC++);
+                        n_signed = (int8_t) fetch8();
                         PC += n_signed;
                         break;
                         case 0x9:       // ADD HL, DE
@@ -894,7 +1148,7 @@ execute()
                         }
                         break;
                         case 0xE:      // LD E, n
-                        reg.e = read_mem(PC++);
+                        reg.e = fetch8();
                         break;
                         case 0xF:       // RRA
                         n = reg.a;
@@ -914,14 +1168,15 @@ execute()
                 case 0x20:
                 switch(opcode & 0x0F) {
                         case 0x0:       // JR NZ, n
-                        n_signed = (int8_t) read_mem(PC++);
+                        n_signed = (int8_t) fetch8();
                         if (!(reg.f & 0x80)) {                         
                                 PC += n_signed;                       
+                                cpu_cycles += 4;      // Branch taken
                         }
                         break;
                         case 0x1:       // LD HL, nn                 
-                        reg.l = read_mem(PC++);
-                        reg.h = read_mem(PC++);
+                        reg.l = fetch8();
+                        reg.h = fetch8();
                         break;
                         case 0x2:      // LDD (HL), A
                         write_mem(reg.hl, reg.a);
@@ -952,7 +1207,7 @@ execute()
                         }
                         break;
                         case 0x6:      // LD H, n
-                        reg.h = read_mem(PC++);
+                        reg.h = fetch8();
                         break;
                         case 0x7:       // DAA           
                         n2 = 0;
@@ -970,9 +1225,10 @@ execute()
                         }
                         break;
                         case 0x8:       // JR Z, n
-                        n_signed = (int8_t) read_mem(PC++);
+                        n_signed = (int8_t) fetch8();
                         if (reg.f & 0x80) {                                     
                                 PC += n_signed;                            
+                                cpu_cycles += 4;      // Branch taken
                         }
                         break;
                         case 0x9:       // ADD HL, HL
@@ -1015,7 +1271,7 @@ execute()
                         }
                         break;
                         case 0xE:      // LD L, n
-                        reg.l = read_mem(PC++);
+                        reg.l = fetch8();
                         break;
                         case 0xF:       // CPL
                         reg.a ^= 0xFF;
@@ -1026,14 +1282,14 @@ execute()
                 case 0x30:
                 switch(opcode & 0x0F) {
                         case 0x0:       // JR NC, n
-                        n_signed = (int8_t) read_mem(PC++);
+                        n_signed = (int8_t) fetch8();
                         if (!(reg.f & 0x10)) {                                 
                                 PC += n_signed;                                    
+                                cpu_cycles += 4;      // Branch taken
                         }
                         break;
                         case 0x1:       // LD SP, nn                          
-                        SP = read_mem(PC++);
-                        SP |= read_mem(PC++) << 8;
+                        SP = fetch16();
                         break;
                         case 0x2:      // LDD (HL), A
                         write_mem(reg.hl, reg.a);
@@ -1066,16 +1322,17 @@ execute()
                         write_mem(reg.hl, n);
                         break;
                         case 0x6:      // LD (HL), n
-                        write_mem(reg.hl, read_mem(PC++));                              
+                        write_mem(reg.hl, fetch8());                              
                         break;
                         case 0x7:       // SCF
                         reg.f &= ~(0x60);
                         reg.f |= 0x10;
                         break;
                         case 0x8:       // JR C, n
-                        n_signed = (int8_t) read_mem(PC++);
+                        n_signed = (int8_t) fetch8();
                         if (reg.f & 0x10) {                                     
                                 PC += n_signed;                 
+                                cpu_cycles += 4;      // Branch taken
                         }
                         break;
                         case 0x9:       // ADD HL, SP
@@ -1118,7 +1375,7 @@ execute()
                         }
                         break;
                         case 0xE:       // LD A, imm
-                        reg.a = read_mem(PC++);
+                        reg.a = fetch8();
                         break;
                         case 0xF:       // CCF
                         reg.f &= ~(0x60);
@@ -1972,43 +2229,41 @@ execute()
                 switch (opcode & 0x0F) {
                         case 0x00:      // RET NZ
                         if (!(reg.f & 0x80)) {
-                                nn = read_mem(SP++);
-                                nn |= read_mem(SP++) << 8;
+                                SAMPLER_RET();
+                                nn = pop16();
                                 PC = nn;
+                                cpu_cycles += 12;      // Branch taken
                         }
                         break;
                         case 0x01:      // POP BC
-                        nn = read_mem(SP++);
-                        nn |= read_mem(SP++) << 8;
+                        nn = pop16();
                         reg.bc = nn;
                         break;
                         case 0x02:      // JP NZ, nn
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
+                        nn = fetch16();
                         if (!(reg.f & 0x80)) {                    
                                 PC = nn;
+                                cpu_cycles += 4;      // Branch taken
                         }
                         break;
                         case 0x03:      // JP nn
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
+                        nn = fetch16();
                         PC = nn;
                         break;
                         case 0x04:      // Call NZ, nn
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
+                        nn = fetch16();
                         if (!(reg.f & 0x80)) {
-                                write_mem(--SP, PC >> 8);
-                                write_mem(--SP, PC & 0x00FF);
+                                push16(PC);
                                 PC = nn;
+                                cpu_cycles += 12;      // Branch taken
+                                SAMPLER_CALL();
                         }
                         break;
                         case 0x05:      // PUSH BC
-                        write_mem(--SP, reg.b);
-                        write_mem(--SP, reg.c);
+                        push16(reg.bc);
                         break;
                         case 0x06:      // ADD A, #
-                        n = read_mem(PC++);
+                        n = fetch8();
                         nn = reg.a + n;
                         reg.f &= ~(0xF0);
                         if ((nn & 0xFF) == 0) {
@@ -2023,31 +2278,32 @@ execute()
                         reg.a = nn & 0xFF;
                         break;
                         case 0x07:      // RST 00
-                        write_mem(--SP, PC >> 8);
-                        write_mem(--SP, PC & 0x00FF);
+                        push16(PC);
                         PC = 0x0000;
+                        SAMPLER_CALL();
                         break;
                         case 0x08:      // RET Z
                         if (reg.f & 0x80) {
-                                nn = read_mem(SP++);
-                                nn |= read_mem(SP++) << 8;
+                                SAMPLER_RET();
+                                nn = pop16();
                                 PC = nn;
+                                cpu_cycles += 12;      // Branch taken
                         }
                         break;
                         case 0x09:      // RET
-                        nn = read_mem(SP++);
-                        nn |= read_mem(SP++) << 8;
+                        SAMPLER_RET();
+                        nn = pop16();
                         PC = nn;
                         break;
                         case 0x0A:      // JP Z, nn
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
+                        nn = fetch16();
                         if (reg.f & 0x80) {                       
                                 PC = nn;
+                                cpu_cycles += 4;      // Branch taken
                         }
                         break;
                         case 0x0B:      // Two byte instructions
-                        cbcode = read_mem(PC++);
+                        cbcode = fetch8();
                         // Getting cycles required for CB instructions
                         cpu_cycles = CB_CYCLES[cbcode];
                         switch(cbcode & 0x07) { //Relevant register
@@ -2222,23 +2478,22 @@ execute()
                         }
                         break;
                         case 0x0C:      // Call Z, nn
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
+                        nn = fetch16();
                         if (reg.f & 0x80) {
-                                write_mem(--SP, PC >> 8);
-                                write_mem(--SP, PC & 0x00FF);
+                                push16(PC);
                                 PC = nn;
+                                cpu_cycles += 12;      // Branch taken
+                                SAMPLER_CALL();
                         }
                         break;
                         case 0x0D:      // CALL nn
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
-                        write_mem(--SP, PC >> 8);
-                        write_mem(--SP, PC & 0x00FF);
+                        nn = fetch16();
+                        push16(PC);
                         PC = nn;
+                        SAMPLER_CALL();
                         break;
                         case 0x0E:      // ADC A, #
-                        n = read_mem(PC++);
+                        n = fetch8();
                         nn = reg.a + n + ((reg.f >> 4) & 0x1);
                         reg.f &= ~(0xF0);
                         if ((nn & 0xFF) == 0) {
@@ -2253,9 +2508,9 @@ execute()
                         reg.a = nn & 0xFF;
                         break;
                         case 0x0F:      // RST 08
-                        write_mem(--SP, PC >> 8);
-                        write_mem(--SP, PC & 0x00FF);
+                        push16(PC);
                         PC = 0x0008;
+                        SAMPLER_CALL();
                         break;
                 }
                 break;
@@ -2263,38 +2518,37 @@ execute()
                 switch (opcode & 0x0F) {
                         case 0x00:      // RET NC
                         if (!(reg.f & 0x10)) {
-                                nn = read_mem(SP++);
-                                nn |= read_mem(SP++) << 8;
+                                SAMPLER_RET();
+                                nn = pop16();
                                 PC = nn;
+                                cpu_cycles += 12;      // Branch taken
                         }
                         break;
                         case 0x01:      // POP DE
-                        nn = read_mem(SP++);
-                        nn |= read_mem(SP++) << 8;
+                        nn = pop16();
                         reg.de = nn;
                         break;
                         case 0x02:      // JP NC, nn
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
+                        nn = fetch16();
                         if (!(reg.f & 0x10)) {                         
                                 PC = nn;
+                                cpu_cycles += 4;      // Branch taken
                         }
                         break;
                         case 0x04:      // Call NC, nn
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
+                        nn = fetch16();
                         if (!(reg.f & 0x10)) {
-                                write_mem(--SP, PC >> 8);
-                                write_mem(--SP, PC & 0x00FF);
+                                push16(PC);
                                 PC = nn;
+                                cpu_cycles += 12;      // Branch taken
+                                SAMPLER_CALL();
                         }
                         break;
                         case 0x05:      // PUSH DE
-                        write_mem(--SP, reg.d);
-                        write_mem(--SP, reg.e);
+                        push16(reg.de);
                         break;
                         case 0x06:      // SUB #
-                        n = read_mem(PC++);
+                        n = fetch8();
                         nn = reg.a - n;
                         reg.f &= ~(0xF0);
                         if ((nn & 0xFF) == 0) {
@@ -2310,41 +2564,43 @@ execute()
                         reg.a = nn & 0xFF;
                         break;
                         case 0x07:      // RST 10
-                        write_mem(--SP, PC >> 8);
-                        write_mem(--SP, PC & 0x00FF);
+                        push16(PC);
                         PC = 0x0010;
+                        SAMPLER_CALL();
                         break;
                         case 0x08:      // RET C
                         if (reg.f & 0x10) {
-                                nn = read_mem(SP++);
-                                nn |= read_mem(SP++) << 8;
+                                SAMPLER_RET();
+                                nn = pop16();
                                 PC = nn;
+                                cpu_cycles += 12;      // Branch taken
                         }
                         break;
                         case 0x09:      // RETI
-			nn = read_mem(SP++);
-			nn |= read_mem(SP++) << 8;
+			SAMPLER_RET();
+			nn = pop16();
 			PC = nn;
 			IME = 1;
+			update_interrupts();
                         break;
                         case 0x0A:      // JP C, nn
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
+                        nn = fetch16();
                         if (reg.f & 0x10) {                         
                                 PC = nn;
+                                cpu_cycles += 4;      // Branch taken
                         }
                         break;
                         case 0x0C:      // Call C, nn
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
+                        nn = fetch16();
                         if (reg.f & 0x10) {
-                                write_mem(--SP, PC >> 8);
-                                write_mem(--SP, PC & 0x00FF);
+                                push16(PC);
                                 PC = nn;
+                                cpu_cycles += 12;      // Branch taken
+                                SAMPLER_CALL();
                         }
                         break;
                         case 0xE:       // SBC A, imm
-                        n = read_mem(PC++);
+                        n = fetch8();
                         nn = reg.a - n - ((reg.f >> 4) & 0x1);
                         reg.f &= ~(0xF0);
                         if ((nn & 0xFF) == 0) {
@@ -2360,31 +2616,29 @@ execute()
                         reg.a = nn & 0xFF;
                         break;
                         case 0x0F:      // RST 18
-                        write_mem(--SP, PC >> 8);
-                        write_mem(--SP, PC & 0x00FF);
+                        push16(PC);
                         PC = 0x0018;
+                        SAMPLER_CALL();
                         break;
                 }
                 break;
                 case 0xE0:
                 switch (opcode & 0x0F) {       
                         case 0x00:      // LDH (n), A
-                        write_mem(read_mem(PC++) | 0xFF00, reg.a);
+                        write_mem(fetch8() | 0xFF00, reg.a);
                         break;
                         case 0x01:      // POP HL
-                        nn = read_mem(SP++);
-                        nn |= read_mem(SP++) << 8;
+                        nn = pop16();
                         reg.hl = nn;
                         break;
                         case 0x02:      // LD (C), A
                         write_mem(reg.c | 0xFF00, reg.a);
                         break;
                         case 0x05:      // PUSH HL
-                        write_mem(--SP, reg.h);
-                        write_mem(--SP, reg.l);
+                        push16(reg.hl);
                         break;
                         case 0x06:      // AND #
-                        n = read_mem(PC++);
+                        n = fetch8();
                         reg.a &= n;
                         reg.f &= ~(0xF0);
                         if (reg.a == 0) {
@@ -2393,12 +2647,12 @@ execute()
                         reg.f |= 0x20;
                         break;
                         case 0x07:      // RST 20
-                        write_mem(--SP, PC >> 8);
-                        write_mem(--SP, PC & 0x00FF);
+                        push16(PC);
                         PC = 0x0020;
+                        SAMPLER_CALL();
                         break;
                         case 0x08:      // ADD SP, #
-                        n_signed = (int8_t) read_mem(PC++);
+                        n_signed = (int8_t) fetch8();
                         nn = SP + n_signed;
                         reg.f &= ~(0xF0);
                         if (n_signed >= 0) {                                
@@ -2423,12 +2677,11 @@ execute()
                         PC = reg.hl;
                         break;
                         case 0xA:       // LD (imm), A
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
+                        nn = fetch16();
                         write_mem(nn, reg.a);
                         break;
                         case 0x0E:      // XOR #
-                        n = read_mem(PC++);
+                        n = fetch8();
                         reg.a ^= n;
                         reg.f &= ~(0xF0);
                         if (reg.a == 0) {
@@ -2436,34 +2689,34 @@ execute()
                         }
                         break;
                         case 0x0F:      // RST 28
-                        write_mem(--SP, PC >> 8);
-                        write_mem(--SP, PC & 0x00FF);
+                        push16(PC);
                         PC = 0x0028;
+                        SAMPLER_CALL();
                         break;
                 }
                 break;
                 case 0xF0:
                 switch (opcode & 0x0F) {
                         case 0x00:      // LDH A, (n)
-                        reg.a = read_mem(read_mem(PC++) | 0xFF00);
+                        reg.a = read_mem(fetch8() | 0xFF00);
                         break;
                         case 0x01:      // POP AF
-                        nn = read_mem(SP++);
-                        nn |= read_mem(SP++) << 8;
+                        nn = pop16();
                         reg.af = nn & 0xFFF0;                            
                         break;
                         case 0x02:      // LD A, (C)
                         reg.a = read_mem(reg.c | 0xFF00);
                         break;
-                        case 0x03:      // DI                                   // TODO: should be delayed?
+                        case 0x03:      // DI
                         IME = 0;
+                        ei_delay = 0;
+                        update_interrupts();
                         break;
                         case 0x05:      // PUSH AF
-                        write_mem(--SP, reg.a);
-                        write_mem(--SP, reg.f);
+                        push16(reg.af);
                         break;
                         case 0x06:      // OR #
-                        n = read_mem(PC++);
+                        n = fetch8();
                         reg.a |= n;
                         reg.f &= ~(0xF0);
                         if (reg.a == 0) {
@@ -2471,12 +2724,12 @@ execute()
                         }
                         break;
                         case 0x07:      // RST 30
-                        write_mem(--SP, PC >> 8);
-                        write_mem(--SP, PC & 0x00FF);
+                        push16(PC);
                         PC = 0x0030;
+                        SAMPLER_CALL();
                         break;
                         case 0x08:      // LDHL SP,n                          
-                        n_signed = (int8_t) read_mem(PC++);
+                        n_signed = (int8_t) fetch8();
                         nn = SP + n_signed;
                         reg.f &= ~(0xF0);
                         if (n_signed >= 0) {                                 
@@ -2501,15 +2754,17 @@ execute()
                         SP = reg.hl;
                         break;
                         case 0xA:       // LD A, (imm)
-                        nn = read_mem(PC++);
-                        nn |= read_mem(PC++) << 8;
+                        nn = fetch16();
                         reg.a = read_mem(nn);
                         break;
-                        case 0x0B:      // EI                                   // TODO: should be delayed?
-                        IME = 1;
+                        case 0x0B:      // EI, takes effect after the next instruction
+                        if (!IME) {
+                                ei_delay = 1;
+                                update_interrupts();
+                        }
                         break;
                         case 0x0E:      // CP #
-                        n = read_mem(PC++);
+                        n = fetch8();
                         nn = reg.a - n;
                         reg.f &= ~(0xF0);
                         if ((nn & 0xFF) == 0) {
@@ -2524,13 +2779,17 @@ execute()
                         }
                         break;
                         case 0x0F:      // RST 38
-                        write_mem(--SP, PC >> 8);
-                        write_mem(--SP, PC & 0x00FF);
+                        push16(PC);
                         PC = 0x0038;
+                        SAMPLER_CALL();
                         break;
                 }
                 break;
         }
+        PROFILE_OP(opcode, cpu_cycles);
+        if (opcode == 0xCB) {
+                PROFILE_CB(cbcode, cpu_cycles);
+        }
         return cpu_cycles;
 }
 
@@ -2542,6 +2801,23 @@ void
 update_timers(uint16_t cycles) 
 {
 
+        cycles_run += cycles;
+        SAMPLER_TICK(cycles);
+
+        // Sound is caught up in batches
+        apu_pending += cycles;
+        if (apu_pending >= APU_BATCH_CYCLES) {
+                apu_sync();
+        }
+
+        // OAM DMA, the bus is given back at the end
+        if (dma_cycles) {
+                dma_cycles = cycles < dma_cycles ? dma_cycles - cycles : 0;
+                if (!dma_cycles) {
+                        update_memory_map();
+                }
+        }
+
         // DIV timer
         div_lower += cycles;
         if (div_lower > 256) {
@@ -2557,7 +2833,7 @@ update_timers(uint16_t cycles)
                         IOR[0x05] ++;
                         if (IOR[0x05] == 0) {   // Overflow
                                 IOR[0x05] = IOR[0x06];
-                                IF |= 0x4;
+                                request_interrupt(0x4);
                         }
                 }
         }
@@ -2579,7 +2855,7 @@ update_lcd(uint16_t cycles)
                 // Interrupt check
                 if (IOR[0x44] == IOR[0x45]) {
                         if (IOR[0x41] & 0x40) {
-                                IF |= 0x2;
+                                request_interrupt(0x2);
                         }
                         IOR[0x41] |= 0x4;
                 }
@@ -2598,7 +2874,7 @@ update_lcd(uint16_t cycles)
 
 
                         if (IOR[0x41] & 0x10) { // HBLANK STAT interrupt
-                                IF |= 0x2;
+                                request_interrupt(0x2);
                         }
                         
                 }
@@ -2609,14 +2885,15 @@ update_lcd(uint16_t cycles)
 
                                                                                 // Increment frame?
 
-                        IF |= 0x1;      // Request interrupt
+                        request_interrupt(0x1);        // VBlank
 
                         if (IOR[0x41] & 0x10) { // VBLANK LCDC interrupt 
-                                IF |= 0x2;
+                                request_interrupt(0x2);
                         }
 
-                        update_SDL();
-                        align_framerate();
+                        apu_sync();
+                        frames_run += 1;
+                        HASHLOG_FRAME();
                 }
                 
         }
@@ -2625,7 +2902,14 @@ update_lcd(uint16_t cycles)
                 // LCD Stat mode
                 IOR[0x41] = (IOR[0x41] & ~(0x3)) | 0x3;
         
-                drawline_lcd(); 
+                if (timing_active) {
+                        uint64_t start = timing_now();
+                        drawline_lcd();
+                        timing_ppu_ns += timing_now() - start;
+                }
+                else {
+                        drawline_lcd();
+                }
         } 
         else if (lcd_cycles > 204 && (IOR[0x41] & 0x3) == 0) {
                 // LCD Stat mode
@@ -2633,11 +2917,61 @@ update_lcd(uint16_t cycles)
 
 
                 if (IOR[0x41] & 0x20) { // HBLANK STAT interrupt
-                        IF |= 0x2;
+                        request_interrupt(0x2);
                 }
         }
 }
 
+/*
+ * The frame loop, inlined so run_frame has no hook to test
+ */
+static inline __attribute__((always_inline)) int
+frame_loop(step_hook hook)
+{
+        long frame = frames_run;
+        uint32_t lcd_off_cycles = 0;
+        uint8_t cycles;
+        int stop;
+
+        while (frames_run == frame) {
+                cycles = execute();
+                update_lcd(cycles);
+                update_timers(cycles);
+
+                if (hook && (stop = hook())) {
+                        return stop;
+                }
+
+                // No VBlank while the LCD is off, so stop after a frame's worth of cycles
+                if (!(IOR[0x40] & 0x80)) {
+                        lcd_off_cycles += cycles;
+                        if (lcd_off_cycles >= 70224) {
+                                break;
+                        }
+                }
+        }
+        return 0;
+}
+
+/*
+ * Run until the next VBlank, presenting and pacing is left to the caller
+ */
+void
+run_frame()
+{
+        frame_loop(NULL);
+}
+
+/*
+ * Run like run_frame, calling the hook after every instruction. A nonzero
+ * result from the hook stops the frame early and is returned, otherwise 0
+ */
+int
+run_frame_with(step_hook hook)
+{
+        return frame_loop(hook);
+}
+
 /*
  * Getter and setter methods, alongside debug functions
 */
@@ -2653,6 +2987,13 @@ get_OAM(uint16_t addr)
         return OAM[addr];
 }
 
+// VRAM bank 0 for the renderer, which isn't held off by OAM DMA
+uint8_t
+get_VRAM(uint16_t addr)
+{
+        return VRAM[(addr - VRAM_ADDR) & 0x1FFF];
+}
+
 uint16_t
 get_PC()
 {
@@ -2665,6 +3006,46 @@ get_opcodes()
         return opcodes_run;
 }
 
+long
+get_frames()
+{
+        return frames_run;
+}
+
+uint64_t
+get_cycles()
+{
+        return cycles_run;
+}
+
+/*
+ * ROM bank mapped at 0x0000, only MBC1 in mode 1 moves it
+ */
+int
+get_rom_bank0()
+{
+        if (cartridge_mapper == 1 && (RMODE & 0x1)) {
+                return ((RBANK2 & 0x3) << mbc1_shift) & bank_mask;
+        }
+        return 0;
+}
+
+/*
+ * ROM bank mapped at 0x4000. Bank numbers wrap at the ROM's size, which
+ * is a power of two, so a bank past the end can't be selected
+ */
+int
+get_rom_bank()
+{
+        if (cartridge_mapper == 1) {
+                return (((RBANK2 & 0x3) << mbc1_shift) | (RBANK1 & ((1 << mbc1_shift) - 1))) & bank_mask;
+        }
+        else if (cartridge_mapper == 3) {
+                return RBANK1 & bank_mask;
+        }
+        return 1;
+}
+
 void
 print_registers() 
 {
@@ -2709,13 +3090,65 @@ log_memory()
 }
 
 
+/*
+ * Joystick state, pressed buttons are 0
+ */
+uint8_t
+get_joystick()
+{
+        return joystick_flags;
+}
+
+/*
+ * Updates joystick flags (set corresponding key to 0 in joystick flags)
+ */
+void
+key_press(uint8_t key)
+{
+        MOVIE_KEY(key, true);
+        if (joystick_flags & key) {
+                update_joystick();
+                joystick_flags &= ~(key);
+        }
+        update_joystick();
+}
+
+
+/*
+ * Updates joystick flags (set corresponding key to 1 in joystick flags)
+ */
+void
+key_release(uint8_t key)
+{
+        MOVIE_KEY(key, false);
+        joystick_flags |= key;
+        update_joystick();
+}
+
+/*
+ * Press and release buttons so exactly those in the given mask are held
+ * (same bits as key_press, set bits are pressed)
+ */
+void
+set_buttons(uint8_t pressed)
+{
+        for (uint8_t key = 0x1; key; key <<= 1) {
+                if ((pressed & key) && (joystick_flags & key)) {
+                        key_press(key);
+                }
+                else if (!(pressed & key) && !(joystick_flags & key)) {
+                        key_release(key);
+                }
+        }
+}
+
 /*
  * Triggered when joystick changes
  */
 void
 update_joystick()
 {
-        IF |= 0x10;
+        request_interrupt(0x10);
 }
 
 /*
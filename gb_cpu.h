@@ -7,19 +7,112 @@
 void init_cpu(uint8_t *rom, uint8_t *save, int num_banks, int cartridge, bool boot);
 uint8_t read_mem(uint16_t addr);
 void write_mem(uint16_t addr, uint8_t val);
+uint8_t peek_mem(uint16_t addr);
+void poke_mem(uint16_t addr, uint8_t val);
+uint16_t read_mem16(uint16_t addr);
+void write_mem16(uint16_t addr, uint16_t val);
+void push16(uint16_t val);
+uint16_t pop16();
+void update_memory_map();
+void update_interrupts();
+void request_interrupt(uint8_t flag);
 void update_timers(uint16_t cycles);
 void update_lcd(uint16_t cycles);
 uint8_t execute();
+typedef int (*step_hook)();
+void run_frame();
+int run_frame_with(step_hook hook);
 uint8_t get_IOR(uint16_t addr);
 uint8_t get_OAM(uint16_t addr);
+uint8_t get_VRAM(uint16_t addr);
 uint16_t get_PC();
 long get_opcodes();
+long get_frames();
+uint64_t get_cycles();
+int get_rom_bank0();
+int get_rom_bank();
 void log_memory();
 void print_registers();
 void update_joystick();
+uint8_t get_joystick();
+void key_press(uint8_t key);
+void key_release(uint8_t key);
+void set_buttons(uint8_t pressed);
 void latch_clock();
 void print_lcd();
 
+/*
+ *      Registers
+ */
+struct registers                      // 8-bit registers
+{
+        union {
+                struct {
+                        uint8_t f;
+                        uint8_t a;
+                };
+                uint16_t af;
+        };
+        union {
+                struct {
+                        uint8_t c;
+                        uint8_t b;
+                };
+                uint16_t bc;
+        };
+        union {
+                struct {
+                        uint8_t e;
+                        uint8_t d;
+                };
+                uint16_t de;
+        };
+        union {
+                struct {
+                        uint8_t l;
+                        uint8_t h;
+                };
+                uint16_t hl;
+        };
+};
+
+/*
+ *      Memory and machine state shared with the other units
+ */
+extern uint8_t *ROM;
+extern uint8_t VRAM[0x4000];
+extern uint8_t ERAM[0x2000];
+extern uint8_t WRAM[0x8000];
+extern uint8_t OAM[0xA0];
+extern uint8_t IOR[0x80];       // I/O Registers
+extern uint8_t HRAM[0x7F];
+extern uint8_t eram_bank;
+
+extern struct registers reg;
+extern uint16_t PC;
+extern uint16_t SP;
+extern uint8_t IME;
+extern uint8_t IE;
+extern uint8_t IF;
+extern uint8_t HALT;
+extern uint8_t ei_delay;
+extern uint8_t halt_bug;
+extern long opcodes_run;
+extern long frames_run;
+extern uint64_t cycles_run;
+
+extern uint8_t RAMG;            // Mapper registers
+extern uint8_t RBANK1;
+extern uint8_t RBANK2;
+extern uint8_t RMODE;
+extern uint8_t MBC3_cwrite;
+
+extern uint16_t div_lower;      // Timer sub-counters
+extern uint16_t tima_lower;
+extern uint16_t lcd_cycles;
+extern uint16_t dma_cycles;
+extern uint8_t joystick_flags;
+
 /*
  *      Constants definitions
  */
@@ -33,4 +126,5 @@ void print_lcd();
 #define WRAM_BANK_SIZE 0x1000
 #define OAM_ADDR 0xFE00
 #define IOR_ADDR 0xFF00
-#define HRAM_ADDR 0xFF80
\ No newline at end of file
+#define HRAM_ADDR 0xFF80
+#define DMA_CYCLES 640        // OAM DMA, 160 bytes at 4 cycles each
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_debug.h"
+
+/*
+ *      Breakpoints and watchpoints
+ *
+ *      Both cost nothing while unused. Breakpoints are a bit per address, only
+ *      looked at by debug_run_frame (run_frame never checks), and then only
+ *      when the page of the next PC holds one. Watchpoints take their page out
+ *      of the core's memory map, so accesses to it go down the slow path in
+ *      read_mem/write_mem, which is the only place they are tested.
+ */
+
+uint8_t debug_breakpoints[0x2000];      // One bit per address
+uint16_t debug_break_pages[0x100];      // Breakpoints per page
+uint8_t debug_watch_read[0x2000];
+uint8_t debug_watch_write[0x2000];
+uint16_t debug_read_pages[0x100];
+uint16_t debug_write_pages[0x100];
+
+int debug_hit = 0;              // Watchpoint type hit by the last instruction
+uint16_t debug_hit_address;
+
+/*
+ * Set or clear a bit in an address bitmap, keeping the page count in step
+ */
+static void
+set_bit(uint8_t *bitmap, uint16_t *pages, uint16_t addr, bool on)
+{
+        uint8_t bit = 1 << (addr & 0x7);
+        if (on && !(bitmap[addr >> 3] & bit)) {
+                bitmap[addr >> 3] |= bit;
+                pages[addr >> 8]++;
+        }
+        else if (!on && (bitmap[addr >> 3] & bit)) {
+                bitmap[addr >> 3] &= ~bit;
+                pages[addr >> 8]--;
+        }
+}
+
+void
+set_breakpoint(uint16_t addr, bool on)
+{
+        set_bit(debug_breakpoints, debug_break_pages, addr, on);
+}
+
+bool
+get_breakpoint(uint16_t addr)
+{
+        return debug_breakpoints[addr >> 3] & (1 << (addr & 0x7));
+}
+
+/*
+ * Watch reads and/or writes of an address (type is DEBUG_READ | DEBUG_WRITE)
+ */
+void
+set_watchpoint(uint16_t addr, int type, bool on)
+{
+        set_watch_range(addr, 1, type, on);
+}
+
+/*
+ * Watch len addresses from addr, wrapping at the top of memory. The memory
+ * map is rebuilt once for the whole range
+ */
+void
+set_watch_range(uint16_t addr, uint32_t len, int type, bool on)
+{
+        for (uint32_t i = 0; i < len; i++) {
+                uint16_t watch_addr = addr + i;
+                if (type & DEBUG_READ) {
+                        set_bit(debug_watch_read, debug_read_pages, watch_addr, on);
+                }
+                if (type & DEBUG_WRITE) {
+                        set_bit(debug_watch_write, debug_write_pages, watch_addr, on);
+                }
+        }
+        update_memory_map();
+}
+
+void
+clear_debug()
+{
+        memset(debug_breakpoints, 0, sizeof(debug_breakpoints));
+        memset(debug_break_pages, 0, sizeof(debug_break_pages));
+        memset(debug_watch_read, 0, sizeof(debug_watch_read));
+        memset(debug_watch_write, 0, sizeof(debug_watch_write));
+        memset(debug_read_pages, 0, sizeof(debug_read_pages));
+        memset(debug_write_pages, 0, sizeof(debug_write_pages));
+        update_memory_map();
+}
+
+/*
+ * Called from the slow path for accesses to a page with watchpoints
+ */
+void
+debug_watch(uint16_t addr, int type)
+{
+        uint8_t *bitmap = type == DEBUG_READ ? debug_watch_read : debug_watch_write;
+        if (bitmap[addr >> 3] & (1 << (addr & 0x7))) {
+                debug_hit = type;
+                debug_hit_address = addr;
+        }
+}
+
+/*
+ * Run a single instruction, returns the watchpoint type it hit (0 for none)
+ */
+int
+debug_step()
+{
+        debug_hit = 0;
+        uint8_t cycles = execute();
+        update_lcd(cycles);
+        update_timers(cycles);
+        return debug_hit;
+}
+
+/*
+ * Stop on a watchpoint the last instruction hit or a breakpoint on the next
+ */
+static int
+debug_check()
+{
+        if (debug_hit) {
+                return debug_hit;
+        }
+        uint16_t pc = get_PC();
+        if (debug_break_pages[pc >> 8] && get_breakpoint(pc)) {
+                debug_hit_address = pc;
+                return DEBUG_BREAK;
+        }
+        return 0;
+}
+
+/*
+ * Run like run_frame, but stop before an instruction with a breakpoint or after
+ * one that touched a watchpoint. Returns 0 once the frame completes, otherwise
+ * DEBUG_BREAK, DEBUG_READ or DEBUG_WRITE. The first instruction always runs, so
+ * calling again continues past the breakpoint just hit
+ */
+int
+debug_run_frame()
+{
+        debug_hit = 0;
+        return run_frame_with(debug_check);
+}
+
+/*
+ * Address of the last breakpoint or watchpoint hit
+ */
+uint16_t
+debug_hit_addr()
+{
+        return debug_hit_address;
+}
@@ -0,0 +1,34 @@
+#include <unistd.h>
+
+/*
+ *      Hooks for the core's slow memory path, watched pages are never mapped
+ */
+extern uint16_t debug_read_pages[0x100];        // Read watchpoints per page
+extern uint16_t debug_write_pages[0x100];       // Write watchpoints per page
+
+#define WATCH_READ(addr) do { \
+        if (debug_read_pages[(addr) >> 8]) debug_watch((addr), DEBUG_READ); \
+} while (0)
+#define WATCH_WRITE(addr) do { \
+        if (debug_write_pages[(addr) >> 8]) debug_watch((addr), DEBUG_WRITE); \
+} while (0)
+
+/*
+ *      Function headers
+ */
+void set_breakpoint(uint16_t addr, bool on);
+bool get_breakpoint(uint16_t addr);
+void set_watchpoint(uint16_t addr, int type, bool on);
+void set_watch_range(uint16_t addr, uint32_t len, int type, bool on);
+void clear_debug();
+void debug_watch(uint16_t addr, int type);
+int debug_step();
+int debug_run_frame();
+uint16_t debug_hit_addr();
+
+/*
+ *      Constants definitions
+ */
+#define DEBUG_READ 1            // Watchpoint types, also debug_run_frame results
+#define DEBUG_WRITE 2
+#define DEBUG_BREAK 4
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_gpu.h"
+#include "gb_rom.h"
+#include "gb_state.h"
+#include "gb_env.h"
+
+/*
+ *      Stepping API
+ *
+ *      A plain C interface for driving the emulator from a training harness
+ *      (over ctypes or similar), with no SDL and no threads:
+ *
+ *              env_open("game.gb", 0);
+ *              env_step(0x80, 60);             // Hold start for a second
+ *              env_checkpoint();               // Reset comes back here
+ *              for (...) {
+ *                      env_step(buttons, 4);
+ *                      uint8_t *pixels = env_observation();
+ *                      uint8_t score = env_read(0xC0A0);
+ *                      if (done) env_reset();
+ *              }
+ *
+ *      The machine is the core's globals, so there is one environment per
+ *      process. Run several processes (or fork, see gb_fork.h) to go wide.
+ */
+
+uint8_t *env_start = NULL;      // Save state reset() returns to
+bool env_loaded = false;
+
+/*
+ * Load a ROM and power on, returns -1 if the ROM can't be used
+ */
+int
+env_open(char *filename, int boot)
+{
+        if (env_loaded) {
+                env_close();
+        }
+        if (read_rom(filename, boot) == -1) {
+                return -1;
+        }
+        init_cpu(load_rom, NULL, num_banks, cartridge_type, boot);
+        init_gpu();
+
+        env_start = malloc(state_size());
+        if (env_start == NULL) {
+                return -1;
+        }
+        env_loaded = true;
+        env_checkpoint();
+        return 0;
+}
+
+void
+env_close()
+{
+        free(env_start);
+        free(load_rom);
+        env_start = NULL;
+        load_rom = NULL;
+        env_loaded = false;
+}
+
+/*
+ * Make the current state the one env_reset() returns to
+ */
+void
+env_checkpoint()
+{
+        save_state_mem(env_start);
+}
+
+/*
+ * Go back to the checkpoint (power on unless moved)
+ */
+int
+env_reset()
+{
+        if (!env_loaded) {
+                return -1;
+        }
+        return load_state_mem(env_start, state_size());
+}
+
+/*
+ * Hold buttons (key_press bits) and run the given number of frames.
+ * Returns the frame count afterwards
+ */
+long
+env_step(uint8_t buttons, int frames)
+{
+        set_buttons(buttons);
+        for (int i = 0; i < frames; i++) {
+                run_frame();
+        }
+        return get_frames();
+}
+
+/*
+ * The last completed frame, ENV_HEIGHT rows of ENV_WIDTH shades (0 white to
+ * 3 black). Points at the renderer's buffer, so it changes on the next step
+ */
+uint8_t *
+env_observation()
+{
+        return &graphics_raw[0][0];
+}
+
+/*
+ * Read a byte as the CPU maps it, including while OAM DMA holds the bus
+ */
+uint8_t
+env_read(uint16_t addr)
+{
+        return peek_mem(addr);
+}
+
+/*
+ * Read a list of addresses in one call, saves a round trip each from Python
+ */
+void
+env_read_many(const uint16_t *addrs, uint8_t *out, int count)
+{
+        for (int i = 0; i < count; i++) {
+                out[i] = peek_mem(addrs[i]);
+        }
+}
+
+uint64_t
+env_cycles()
+{
+        return get_cycles();
+}
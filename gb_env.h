@@ -0,0 +1,25 @@
+#include <unistd.h>
+
+/*
+ *      Exported from the shared library, everything else may be hidden
+ */
+#define GB_EXPORT __attribute__((visibility("default")))
+
+/*
+ *      Function headers
+ */
+GB_EXPORT int env_open(char *filename, int boot);
+GB_EXPORT void env_close();
+GB_EXPORT void env_checkpoint();
+GB_EXPORT int env_reset();
+GB_EXPORT long env_step(uint8_t buttons, int frames);
+GB_EXPORT uint8_t *env_observation();
+GB_EXPORT uint8_t env_read(uint16_t addr);
+GB_EXPORT void env_read_many(const uint16_t *addrs, uint8_t *out, int count);
+GB_EXPORT uint64_t env_cycles();
+
+/*
+ *      Constants definitions
+ */
+#define ENV_WIDTH 160
+#define ENV_HEIGHT 144
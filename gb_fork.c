@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "main.h"
+#include "gb_capture.h"
+#include "gb_fork.h"
+
+/*
+ *      Instance forking
+ *
+ *      The whole machine lives in process globals, so the cheapest clone of
+ *      an instance is the process itself. fork() shares every page with the
+ *      parent copy-on-write, so a branch only pays for the 4 KB pages it
+ *      dirties (typically a few pages of WRAM, VRAM and the CPU state) rather
+ *      than a full state copy, and thousands of branches can be taken from
+ *      one checkpoint.
+ *
+ *      Only the forking thread exists in the child. Capture is detached, and
+ *      the APU ring simply fills up and drops samples with nobody draining it,
+ *      so branches should be run headless and unthrottled. Children must leave
+ *      with _exit so the parent's stdio buffers and atexit handlers don't run
+ *      twice. The clones of run_branches get their own process group, which
+ *      also means a Ctrl-C at the terminal only reaches the parent.
+ */
+
+/*
+ * Clone the running instance. Returns 0 in the clone, the clone's pid in
+ * the original, or -1 if the fork failed
+ */
+pid_t
+fork_instance()
+{
+        // Anything buffered would otherwise be printed by both
+        fflush(stdout);
+        fflush(stderr);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+                detach_capture();
+        }
+        return pid;
+}
+
+/*
+ * Wait for a clone to finish, returns its exit status or -1 if it crashed
+ */
+int
+join_instance(pid_t pid)
+{
+        int status;
+        if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status)) {
+                return -1;
+        }
+        return WEXITSTATUS(status);
+}
+
+/*
+ * Wait for whichever running clone finishes first, which then leaves pids.
+ * Only the clones' process group is waited on, so other children of the
+ * process (clones from fork_instance, a capture encoder) are left alone.
+ * Returns true if the clone exited normally with status 0
+ */
+static bool
+reap_branch(pid_t group, pid_t *pids, int *running)
+{
+        int status;
+        pid_t reaped;
+        do {
+                reaped = waitpid(-group, &status, 0);
+        } while (reaped == -1 && errno == EINTR);
+
+        int done = 0;
+        while (done < *running - 1 && pids[done] != reaped) {
+                done++;
+        }
+        if (reaped == -1) {
+                status = -1;    // Lost track of them, count one as failed
+        }
+        pids[done] = pids[--*running];
+        return status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+ * Run func in count clones of the current instance, at most max_running at
+ * once (0 for one per core). Clone i gets branch i and writes result_size
+ * bytes of its result, which are gathered into results[i]. Clones that
+ * crash leave their result zeroed. Returns the number of clones that failed
+ * or -1 on error
+ */
+int
+run_branches(int count, int max_running, branch_func func, void *arg, void *results, size_t result_size)
+{
+        if (max_running <= 0) {
+                max_running = sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        max_running = MAX(max_running, 1);
+
+        // Written by the clones directly, anonymous shared pages start zeroed
+        size_t shared_size = MAX(count * result_size, 1);
+        uint8_t *shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shared == MAP_FAILED) {
+                return -1;
+        }
+        pid_t *pids = malloc(max_running * sizeof(pid_t));      // Running clones
+        if (pids == NULL) {
+                munmap(shared, shared_size);
+                return -1;
+        }
+
+        // The running clones form one process group, led by the first of them
+        // (a new group once they have all been reaped)
+        pid_t group = 0;
+        int next = 0;
+        int running = 0;
+        int failures = 0;
+        while (next < count || running) {
+                if (running == 0) {
+                        group = 0;
+                }
+                while (running < max_running && next < count) {
+                        pid_t pid = fork_instance();
+                        if (pid == 0) {
+                                setpgid(0, group);
+                                func(next, arg, shared + next * result_size);
+                                _exit(0);
+                        }
+                        if (pid == -1) {
+                                break;
+                        }
+                        // Also set here, so the group exists before waiting on it
+                        setpgid(pid, group);
+                        if (group == 0) {
+                                group = pid;
+                        }
+                        pids[running++] = pid;
+                        next++;
+                }
+                if (running == 0) {
+                        free(pids);
+                        munmap(shared, shared_size);
+                        return -1;
+                }
+                failures += !reap_branch(group, pids, &running);
+        }
+        free(pids);
+
+        if (results) {
+                memcpy(results, shared, count * result_size);
+        }
+        munmap(shared, shared_size);
+        return failures;
+}
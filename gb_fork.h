@@ -0,0 +1,10 @@
+#include <unistd.h>
+
+/*
+ *      Function headers
+ */
+typedef void (*branch_func)(int branch, void *arg, void *result);
+
+pid_t fork_instance();
+int join_instance(pid_t pid);
+int run_branches(int count, int max_running, branch_func func, void *arg, void *results, size_t result_size);
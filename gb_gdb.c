@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_debug.h"
+#include "gb_gdb.h"
+
+/*
+ *      Remote debugging stub
+ *
+ *      Speaks the GDB remote serial protocol on a local TCP port, so a
+ *      debugger or a script can drive the emulator instead of the keyboard.
+ *      Packets are "$data#checksum" and are acked with '+'; the stub ignores
+ *      acks it receives, as TCP doesn't lose data.
+ *
+ *      Supported: ? g G p P m M s c Z0-Z4 z0-z4 k D, qSupported and qAttached.
+ *      Everything else gets the empty reply, meaning unsupported. Registers are
+ *      16 bit little endian in the order AF BC DE HL SP PC, the start of GDB's
+ *      z80 register set. Between stops the machine runs through
+ *      debug_run_frame at full speed, and Ctrl-C (a raw 0x03 byte) is looked
+ *      for once a frame.
+ */
+
+int gdb_socket = -1;
+bool gdb_active = false;
+bool gdb_running = false;       // Continuing, as opposed to stopped
+char gdb_last_stop[32] = "S05"; // Reply to '?'
+
+// Received bytes not handled yet
+uint8_t gdb_in[GDB_PACKET_SIZE];
+int gdb_in_len = 0;
+int gdb_in_pos = 0;
+
+/*
+ * Next byte from the debugger, waiting for it. Returns -1 once it has gone
+ */
+static int
+gdb_getc()
+{
+        if (gdb_in_pos == gdb_in_len) {
+                ssize_t received = recv(gdb_socket, gdb_in, sizeof(gdb_in), 0);
+                if (received <= 0) {
+                        return -1;
+                }
+                gdb_in_len = received;
+                gdb_in_pos = 0;
+        }
+        return gdb_in[gdb_in_pos++];
+}
+
+/*
+ * Check for Ctrl-C without waiting. Returns 1 for an interrupt, -1 once the
+ * debugger has gone and 0 otherwise
+ */
+static int
+gdb_poll()
+{
+        if (gdb_in_pos == gdb_in_len) {
+                ssize_t received = recv(gdb_socket, gdb_in, sizeof(gdb_in), MSG_DONTWAIT);
+                if (received == 0) {
+                        return -1;
+                }
+                if (received < 0) {
+                        return 0;
+                }
+                gdb_in_len = received;
+                gdb_in_pos = 0;
+        }
+        if (gdb_in[gdb_in_pos] == 0x03) {
+                gdb_in_pos++;
+                return 1;
+        }
+        return 0;
+}
+
+/*
+ * Frame and send a packet
+ */
+static void
+gdb_send(const char *data)
+{
+        char packet[GDB_PACKET_SIZE + 4];
+        uint8_t sum = 0;
+        for (const char *c = data; *c; c++) {
+                sum += *c;
+        }
+        int len = snprintf(packet, sizeof(packet), "$%s#%02x", data, sum);
+        send(gdb_socket, packet, len, MSG_NOSIGNAL);
+}
+
+/*
+ * Read the next packet's data into buf, dropping acks, stray Ctrl-Cs and
+ * packets with a bad checksum. Returns -1 once the debugger has gone
+ */
+static int
+gdb_read_packet(char *buf)
+{
+        while (true) {
+                int c;
+                do {
+                        c = gdb_getc();
+                        if (c == -1) {
+                                return -1;
+                        }
+                } while (c != '$');
+
+                int len = 0;
+                uint8_t sum = 0;
+                while ((c = gdb_getc()) != '#') {
+                        if (c == -1) {
+                                return -1;
+                        }
+                        if (len < GDB_PACKET_SIZE - 1) {
+                                buf[len++] = c;
+                        }
+                        sum += c;
+                }
+                char check[3];
+                check[0] = gdb_getc();
+                check[1] = gdb_getc();
+                check[2] = '\0';
+                buf[len] = '\0';
+                if (strtol(check, NULL, 16) == sum) {
+                        send(gdb_socket, "+", 1, MSG_NOSIGNAL);
+                        return len;
+                }
+                send(gdb_socket, "-", 1, MSG_NOSIGNAL);
+        }
+}
+
+/*
+ * Value of a pair of hex digits
+ */
+static uint8_t
+hex_byte(const char *hex)
+{
+        char pair[3] = {hex[0], hex[1], '\0'};
+        return strtol(pair, NULL, 16);
+}
+
+/*
+ * Register n of the AF BC DE HL SP PC set
+ */
+static uint16_t *
+gdb_register(unsigned long n)
+{
+        uint16_t *registers[GDB_REGISTERS] = {&reg.af, &reg.bc, &reg.de, &reg.hl, &SP, &PC};
+        return n < GDB_REGISTERS ? registers[n] : NULL;
+}
+
+/*
+ * Report a stop: DEBUG_BREAK (also used for steps), a watchpoint type, or 0
+ * when interrupted
+ */
+static void
+gdb_stopped(int hit)
+{
+        gdb_running = false;
+        if (hit == DEBUG_WRITE) {
+                snprintf(gdb_last_stop, sizeof(gdb_last_stop), "T05watch:%04x;", debug_hit_addr());
+        }
+        else if (hit == DEBUG_READ) {
+                snprintf(gdb_last_stop, sizeof(gdb_last_stop), "T05rwatch:%04x;", debug_hit_addr());
+        }
+        else {
+                snprintf(gdb_last_stop, sizeof(gdb_last_stop), hit ? "S05" : "S02");
+        }
+        gdb_send(gdb_last_stop);
+}
+
+/*
+ * Drop the connection along with its breakpoints and watchpoints, the machine
+ * runs on freely
+ */
+static void
+gdb_disconnect()
+{
+        close(gdb_socket);
+        gdb_active = false;
+        gdb_running = true;
+        clear_debug();
+}
+
+/*
+ * Handle one packet while stopped. Returns -1 when asked to kill the machine
+ */
+static int
+gdb_command(char *packet)
+{
+        char reply[GDB_PACKET_SIZE];
+        char *pos = packet + 1;
+        unsigned long addr, len, type;
+        reply[0] = '\0';
+
+        switch (packet[0]) {
+                case '?':       // Last stop reason
+                gdb_send(gdb_last_stop);
+                return 0;
+                case 'g':       // Read registers
+                for (int i = 0; i < GDB_REGISTERS; i++) {
+                        uint16_t value = *gdb_register(i);
+                        sprintf(reply + i * 4, "%02x%02x", value & 0xFF, value >> 8);
+                }
+                break;
+                case 'G':       // Write registers
+                for (int i = 0; i < GDB_REGISTERS && strlen(pos) >= 4; i++, pos += 4) {
+                        *gdb_register(i) = hex_byte(pos) | (hex_byte(pos + 2) << 8);
+                }
+                reg.af &= 0xFFF0;
+                strcpy(reply, "OK");
+                break;
+                case 'p':       // Read one register, GDB's others are unavailable
+                addr = strtoul(pos, NULL, 16);
+                if (gdb_register(addr)) {
+                        uint16_t value = *gdb_register(addr);
+                        sprintf(reply, "%02x%02x", value & 0xFF, value >> 8);
+                }
+                else {
+                        strcpy(reply, "xxxx");
+                }
+                break;
+                case 'P':       // Write one register
+                addr = strtoul(pos, &pos, 16);
+                if (gdb_register(addr) && *pos == '=' && strlen(pos + 1) >= 4) {
+                        *gdb_register(addr) = hex_byte(pos + 1) | (hex_byte(pos + 3) << 8);
+                        reg.af &= 0xFFF0;
+                }
+                strcpy(reply, "OK");
+                break;
+                case 'm':       // Read memory, as the CPU sees it
+                addr = strtoul(pos, &pos, 16);
+                len = strtoul(pos + 1, NULL, 16);
+                len = MIN(len, (GDB_PACKET_SIZE - 8) / 2);
+                for (unsigned long i = 0; i < len; i++) {
+                        sprintf(reply + i * 2, "%02x", peek_mem(addr + i));
+                }
+                break;
+                case 'M':       // Write memory
+                addr = strtoul(pos, &pos, 16);
+                len = strtoul(pos + 1, &pos, 16);
+                if (*pos != ':' || strlen(pos + 1) < len * 2) {
+                        strcpy(reply, "E01");
+                        break;
+                }
+                for (unsigned long i = 0; i < len; i++) {
+                        poke_mem(addr + i, hex_byte(pos + 1 + i * 2));
+                }
+                strcpy(reply, "OK");
+                break;
+                case 's':       // Step, optionally from a new PC
+                if (*pos) {
+                        PC = strtoul(pos, NULL, 16);
+                }
+                type = debug_step();
+                gdb_stopped(type ? type : DEBUG_BREAK);
+                return 0;
+                case 'c':       // Continue, replied to at the next stop
+                if (*pos) {
+                        PC = strtoul(pos, NULL, 16);
+                }
+                gdb_running = true;
+                return 0;
+                case 'Z':       // Set and clear breakpoints and watchpoints
+                case 'z':
+                type = strtoul(pos, &pos, 16);
+                addr = strtoul(pos + 1, &pos, 16);
+                len = strtoul(pos + 1, NULL, 16);
+                if (type <= 1) {        // Software and hardware breakpoints alike
+                        set_breakpoint(addr, packet[0] == 'Z');
+                }
+                else if (type <= 4) {   // Write, read and access watchpoints
+                        int kind = type == 2 ? DEBUG_WRITE : type == 3 ? DEBUG_READ : DEBUG_READ | DEBUG_WRITE;
+                        // Past 0x10000 a range would only cover memory again
+                        set_watch_range(addr, MIN(MAX(len, 1), 0x10000), kind, packet[0] == 'Z');
+                }
+                else {
+                        break;
+                }
+                strcpy(reply, "OK");
+                break;
+                case 'k':       // Kill
+                return -1;
+                case 'D':       // Detach, running on without breakpoints
+                gdb_send("OK");
+                gdb_disconnect();
+                return 0;
+                case 'H':       // Thread selection, there is only one
+                strcpy(reply, "OK");
+                break;
+                case 'q':
+                if (strncmp(packet, "qSupported", 10) == 0) {
+                        snprintf(reply, sizeof(reply), "PacketSize=%x", GDB_PACKET_SIZE - 8);
+                }
+                else if (strcmp(packet, "qAttached") == 0) {
+                        strcpy(reply, "1");
+                }
+                break;
+        }
+        gdb_send(reply);
+        return 0;
+}
+
+/*
+ * Listen on a local port and wait for a debugger to attach. The machine
+ * starts out stopped
+ */
+int
+init_gdb(int port)
+{
+        int server = socket(AF_INET, SOCK_STREAM, 0);
+        if (server == -1) {
+                printf("Error opening GDB socket\n");
+                return -1;
+        }
+        int one = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(server, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(server, 1) == -1) {
+                printf("Error listening on port %d\n", port);
+                close(server);
+                return -1;
+        }
+
+        printf("Waiting for GDB on port %d\n", port);
+        fflush(stdout);
+        gdb_socket = accept(server, NULL, NULL);
+        close(server);
+        if (gdb_socket == -1) {
+                printf("Error accepting GDB connection\n");
+                return -1;
+        }
+        setsockopt(gdb_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        gdb_in_len = gdb_in_pos = 0;
+        gdb_running = false;
+        strcpy(gdb_last_stop, "S05");
+        gdb_active = true;
+        return 0;
+}
+
+/*
+ * Run the machine for a frame under the debugger, use in place of run_frame.
+ * While stopped this serves packets until told to step or continue. Returns 1
+ * when a frame completed, 0 if it was cut short by a stop and -1 when the
+ * debugger kills the machine or goes away
+ */
+int
+gdb_frame()
+{
+        // Ctrl-C, looked for once a frame
+        if (gdb_running) {
+                int interrupt = gdb_poll();
+                if (interrupt == -1) {
+                        return -1;
+                }
+                if (interrupt) {
+                        gdb_stopped(0);
+                }
+        }
+
+        char packet[GDB_PACKET_SIZE];
+        while (gdb_active && !gdb_running) {
+                if (gdb_read_packet(packet) == -1 || gdb_command(packet) == -1) {
+                        return -1;
+                }
+        }
+
+        int hit = debug_run_frame();
+        if (hit && gdb_active) {
+                gdb_stopped(hit);
+                return 0;
+        }
+        return 1;
+}
+
+/*
+ * Tell the debugger the machine has exited and disconnect
+ */
+void
+close_gdb()
+{
+        if (gdb_active) {
+                gdb_send("W00");
+                gdb_disconnect();
+        }
+}
@@ -0,0 +1,19 @@
+#include <unistd.h>
+
+/*
+ *      Shared variables
+ */
+extern bool gdb_active;         // A debugger is attached
+
+/*
+ *      Function headers
+ */
+int init_gdb(int port);
+int gdb_frame();
+void close_gdb();
+
+/*
+ *      Constants definitions
+ */
+#define GDB_PACKET_SIZE 4096    // Largest packet either way, with framing
+#define GDB_REGISTERS 6         // AF BC DE HL SP PC
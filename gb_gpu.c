@@ -1,6 +1,5 @@
 #include <stdio.h>
-#include <SDL.h>
-#include <SDL_audio.h>
+#include <stdint.h>
 #include <math.h>
 #include <stdbool.h>
 #include <unistd.h>
@@ -9,6 +8,7 @@
 #include "main.h"
 #include "gb_cpu.h"
 #include "gb_gpu.h"
+#include "gb_hash.h"
 
 
 
@@ -28,11 +28,7 @@ uint8_t sprite_tile;
 uint8_t sprite_attr;
 
 
-// SDL elements
-SDL_Window *window;
-SDL_Renderer *renderer;
-SDL_Texture *texture;
-uint32_t graphics[144][160];
+// Completed frame
 uint8_t graphics_raw[144][160];
 
 /*
@@ -65,7 +61,7 @@ drawline_lcd()
                         tile_map_addr += 0x9800;
                 }
                 // Finding tile addr
-                tile_addr = read_mem(tile_map_addr + (get_IOR(0x43) >> 3));
+                tile_addr = get_VRAM(tile_map_addr + (get_IOR(0x43) >> 3));
                 // Tile data area
                 if (get_IOR(0x40) & 0x10) {
                         tile_addr = 0x8000 + tile_addr * 16;
@@ -82,8 +78,8 @@ drawline_lcd()
                 tile_addr += tile_y * 2;
 
                 // Getting tiles
-                tile_1 = read_mem(tile_addr);
-                tile_2 = read_mem(tile_addr + 1);
+                tile_1 = get_VRAM(tile_addr);
+                tile_2 = get_VRAM(tile_addr + 1);
                 // Drawing the entire row
                 for (int x = 0; x < 160; x++) {
 
@@ -97,7 +93,7 @@ drawline_lcd()
 
                         tile_x++;
                         if (tile_x == 8) {      // Get next tile in row
-                                tile_addr = read_mem(tile_map_addr + (((get_IOR(0x43) + x + 1) % 0x100) >> 3));
+                                tile_addr = get_VRAM(tile_map_addr + (((get_IOR(0x43) + x + 1) % 0x100) >> 3));
 
                                 // Tile data area
                                 if (get_IOR(0x40) & 0x10) {
@@ -110,8 +106,8 @@ drawline_lcd()
                                 tile_addr +=  2 * tile_y;
                                                 
                                 // Getting tiles
-                                tile_1 = read_mem(tile_addr);
-                                tile_2 = read_mem(tile_addr + 1);
+                                tile_1 = get_VRAM(tile_addr);
+                                tile_2 = get_VRAM(tile_addr + 1);
 
                                 tile_x = 0;
                         }
@@ -136,7 +132,7 @@ drawline_lcd()
                 }
 
                 // Finding tile addr
-                tile_addr = read_mem(tile_map_addr + ((get_IOR(0x4B) - 7) >> 3));
+                tile_addr = get_VRAM(tile_map_addr + ((get_IOR(0x4B) - 7) >> 3));
 
                 // Tile data area
                 if (get_IOR(0x40) & 0x10) {
@@ -154,8 +150,8 @@ drawline_lcd()
                 tile_addr += tile_y * 2;
 
                 // Getting tiles
-                tile_1 = read_mem(tile_addr);
-                tile_2 = read_mem(tile_addr + 1);
+                tile_1 = get_VRAM(tile_addr);
+                tile_2 = get_VRAM(tile_addr + 1);
 
                 // Drawing the entire row
                 for (uint8_t x = 0; x < 160 - (get_IOR(0x4B) - 7); x++) {           // Fix to properly aknowledge window placement
@@ -170,7 +166,7 @@ drawline_lcd()
 
                         tile_x ++;
                         if (tile_x == 8) {      // Get next tile in row
-                                tile_addr = read_mem(tile_map_addr + (((get_IOR(0x4B) - 7) % 0x100) >> 3) + x + 1);
+                                tile_addr = get_VRAM(tile_map_addr + (((get_IOR(0x4B) - 7) % 0x100) >> 3) + x + 1);
 
                                 // Tile data area
                                 if (get_IOR(0x40) & 0x10) {
@@ -183,8 +179,8 @@ drawline_lcd()
                                 tile_addr += 2 * tile_y;
                                                 
                                 // Getting tiles
-                                tile_1 = read_mem(tile_addr);
-                                tile_2 = read_mem(tile_addr + 1);
+                                tile_1 = get_VRAM(tile_addr);
+                                tile_2 = get_VRAM(tile_addr + 1);
 
                                 tile_x = 0;
                         }
@@ -228,8 +224,8 @@ drawline_lcd()
                                 }
 
                                 // Getting tiles
-                                tile_1 = read_mem(tile_addr);
-                                tile_2 = read_mem(tile_addr + 1);
+                                tile_1 = get_VRAM(tile_addr);
+                                tile_2 = get_VRAM(tile_addr + 1);
 
                                 if (flip_x) {
                                         tile_1 <<= sprite_x - MIN(sprite_x, 160);        // Maybe clean these up?
@@ -286,48 +282,10 @@ drawline_lcd()
 }
 
 /*
- * Initialize SDL elements
+ * xxHash64 of the current frame, for comparing runs
  */
-int
-init_SDL()
+uint64_t
+hash_frame()
 {
-        // Initialize all SDL systems
-        if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
-                // Send message if fails
-                printf("error initializing SDL: %s\n", SDL_GetError());
-                return -1;
-        }
-        // Create parts of window (64 by 32 pixels)
-        window = SDL_CreateWindow("Gameboy", 
-                                        SDL_WINDOWPOS_CENTERED,
-                                        SDL_WINDOWPOS_CENTERED,
-                                        480, 432, 0);
-
-        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-        SDL_RenderSetLogicalSize(renderer, 160, 144);
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255); 
-
-        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, 
-                                        SDL_TEXTUREACCESS_STREAMING, 160, 144);
-        return 1; // Return 1 when there is no problem
+        return xxh64(graphics_raw, sizeof(graphics_raw), 0);
 }
-
-
-/*
- * Update SDL elements
- */
-uint32_t colors[4] = {0xFFFFFFFF, 0xAAAAAAAA, 0x55555555, 0x00000000};
-void update_SDL()
-{
-        // Filling pixels corresponding to graphics array
-        for (int i = 0; i < 144; i++) {
-                for (int j = 0; j < 160; j++) {
-                        graphics[i][j] = colors[graphics_raw[i][j]];
-                }
-        }
-        // Applying texture to screen
-        SDL_UpdateTexture(texture, NULL, graphics, 160 * sizeof(uint32_t));
-        SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, texture, NULL, NULL);
-        SDL_RenderPresent(renderer);
-}
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include <unistd.h>
 
+extern uint8_t graphics_raw[144][160];  // Shade (0-3) of each pixel
+
 void init_gpu();
 void drawline_lcd();
-void update_SDL();
\ No newline at end of file
+uint64_t hash_frame();
\ No newline at end of file
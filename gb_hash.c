@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_gpu.h"
+#include "gb_hash.h"
+
+/*
+ *      Frame hashing
+ *
+ *      xxHash64 of the frame (hash_frame) and optionally of the registers,
+ *      WRAM and HRAM (hash_state), logged at every VBlank as lines of
+ *      "<frame> <frame hash> [<state hash>]". Two logs are compared with
+ *      hashdiff, which reports the first frame where they differ.
+ */
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+FILE *hashlog_file;
+bool hashlog_active = false;
+bool hashlog_state;             // Log hash_state too
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+        return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+read64(const uint8_t *p)
+{
+        uint64_t value;
+        memcpy(&value, p, 8);
+        return value;
+}
+
+static inline uint64_t
+xxh64_round(uint64_t acc, uint64_t input)
+{
+        acc += input * PRIME64_2;
+        return rotl64(acc, 31) * PRIME64_1;
+}
+
+static inline uint64_t
+xxh64_merge(uint64_t acc, uint64_t value)
+{
+        acc ^= xxh64_round(0, value);
+        return acc * PRIME64_1 + PRIME64_4;
+}
+
+/*
+ * xxHash64 of a buffer, for little endian hosts
+ */
+uint64_t
+xxh64(const void *data, size_t len, uint64_t seed)
+{
+        const uint8_t *p = data;
+        const uint8_t *end = p + len;
+        uint64_t h;
+
+        if (len >= 32) {
+                // Four independent lanes over 32 byte stripes
+                uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+                uint64_t v2 = seed + PRIME64_2;
+                uint64_t v3 = seed;
+                uint64_t v4 = seed - PRIME64_1;
+                while (p + 32 <= end) {
+                        v1 = xxh64_round(v1, read64(p));
+                        v2 = xxh64_round(v2, read64(p + 8));
+                        v3 = xxh64_round(v3, read64(p + 16));
+                        v4 = xxh64_round(v4, read64(p + 24));
+                        p += 32;
+                }
+                h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+                h = xxh64_merge(h, v1);
+                h = xxh64_merge(h, v2);
+                h = xxh64_merge(h, v3);
+                h = xxh64_merge(h, v4);
+        }
+        else {
+                h = seed + PRIME64_5;
+        }
+        h += len;
+
+        // Tail
+        while (p + 8 <= end) {
+                h ^= xxh64_round(0, read64(p));
+                h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+                p += 8;
+        }
+        if (p + 4 <= end) {
+                uint32_t word;
+                memcpy(&word, p, 4);
+                h ^= word * PRIME64_1;
+                h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+                p += 4;
+        }
+        while (p < end) {
+                h ^= *p++ * PRIME64_5;
+                h = rotl64(h, 11) * PRIME64_1;
+        }
+
+        h ^= h >> 33;
+        h *= PRIME64_2;
+        h ^= h >> 29;
+        h *= PRIME64_3;
+        h ^= h >> 32;
+        return h;
+}
+
+/*
+ * Hash of the CPU registers, WRAM and HRAM
+ */
+uint64_t
+hash_state()
+{
+        uint8_t registers[14];
+        memcpy(registers, &reg, 8);
+        memcpy(registers + 8, &PC, 2);
+        memcpy(registers + 10, &SP, 2);
+        registers[12] = IME;
+        registers[13] = IE;
+        uint64_t hash = xxh64(registers, sizeof(registers), 0);
+        hash = xxh64(WRAM, 0x2000, hash);
+        return xxh64(HRAM, sizeof(HRAM), hash);
+}
+
+/*
+ * Log hashes to a file at every VBlank
+ */
+int
+init_hashlog(char *filename, bool with_state)
+{
+        hashlog_file = fopen(filename, "w");
+        if (hashlog_file == NULL) {
+                printf("Error opening hash log %s\n", filename);
+                return -1;
+        }
+        hashlog_state = with_state;
+        hashlog_active = true;
+        return 0;
+}
+
+/*
+ * Called by update_lcd at VBlank, once the frame is complete
+ */
+void
+hashlog_frame()
+{
+        if (hashlog_state) {
+                fprintf(hashlog_file, "%ld %016" PRIx64 " %016" PRIx64 "\n",
+                        get_frames(), hash_frame(), hash_state());
+        }
+        else {
+                fprintf(hashlog_file, "%ld %016" PRIx64 "\n", get_frames(), hash_frame());
+        }
+}
+
+void
+close_hashlog()
+{
+        if (hashlog_active) {
+                fclose(hashlog_file);
+                hashlog_active = false;
+        }
+}
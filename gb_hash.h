@@ -0,0 +1,17 @@
+#include <unistd.h>
+
+/*
+ *      Hook for update_lcd, a flag test while no log is open
+ */
+extern bool hashlog_active;
+
+#define HASHLOG_FRAME() do { if (hashlog_active) hashlog_frame(); } while (0)
+
+/*
+ *      Function headers
+ */
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+uint64_t hash_state();
+int init_hashlog(char *filename, bool with_state);
+void hashlog_frame();
+void close_hashlog();
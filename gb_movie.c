@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_gpu.h"
+#include "gb_state.h"
+#include "gb_movie.h"
+
+/*
+ *      Input movies
+ *
+ *      Records every key_press/key_release stamped with the cycle it happened
+ *      on, and the frame hash after every frame. Playback from power on
+ *      applies each key at the same cycle (frontends only deliver keys
+ *      between frames, so that is always a frame boundary) and checks every
+ *      frame's hash, stopping at the first frame that differs.
+ *
+ *      Movies are text: a "GBMOVIE <version> <rom id> <boot>" header, then
+ *      "K <cycle> <P|R> <key>" for keys and "H <frame> <hash>" for frames,
+ *      in the order they happened.
+ */
+
+struct movie_event {
+        uint64_t cycle;
+        uint8_t key;
+        bool pressed;
+};
+
+FILE *movie_file;               // Open while recording
+bool movie_active = false;
+bool movie_recording = false;
+bool movie_applying = false;    // Keys coming from the movie itself
+bool movie_boot_rom;
+long movie_frames = 0;          // Frames recorded or played so far
+
+// Playback
+struct movie_event *movie_events;
+long movie_num_events = 0;
+long movie_next_event = 0;
+uint64_t *movie_hashes;
+long movie_num_hashes = 0;
+
+/*
+ * Start recording, call after the ROM is loaded and before the first frame
+ */
+int
+record_movie(char *filename, bool boot)
+{
+        movie_file = fopen(filename, "w");
+        if (movie_file == NULL) {
+                printf("Error opening movie %s\n", filename);
+                return -1;
+        }
+        fprintf(movie_file, "GBMOVIE %d %06x %d\n", MOVIE_VERSION, rom_id(), boot);
+        movie_boot_rom = boot;
+        movie_frames = 0;
+        movie_recording = true;
+        movie_active = true;
+        return 0;
+}
+
+/*
+ * Load a movie for playback, call after the ROM is loaded and then start the
+ * machine with movie_boot()
+ */
+int
+play_movie(char *filename)
+{
+        FILE *movie = fopen(filename, "r");
+        if (movie == NULL) {
+                printf("Error opening movie %s\n", filename);
+                return -1;
+        }
+        int version, boot;
+        unsigned id;
+        if (fscanf(movie, "GBMOVIE %d %x %d", &version, &id, &boot) != 3 || version != MOVIE_VERSION) {
+                printf("Movie %s is from another version\n", filename);
+                fclose(movie);
+                return -1;
+        }
+        if (id != rom_id()) {
+                printf("Movie %s is for another ROM\n", filename);
+                fclose(movie);
+                return -1;
+        }
+
+        long event_capacity = 256, hash_capacity = 4096;
+        movie_events = malloc(event_capacity * sizeof(struct movie_event));
+        movie_hashes = malloc(hash_capacity * sizeof(uint64_t));
+        movie_num_events = movie_num_hashes = 0;
+
+        char type;
+        while (fscanf(movie, " %c", &type) == 1) {
+                if (type == 'K') {
+                        struct movie_event event;
+                        char action;
+                        if (fscanf(movie, "%" SCNu64 " %c %hhx", &event.cycle, &action, &event.key) != 3) {
+                                break;
+                        }
+                        event.pressed = action == 'P';
+                        if (movie_num_events == event_capacity) {
+                                event_capacity *= 2;
+                                movie_events = realloc(movie_events, event_capacity * sizeof(struct movie_event));
+                        }
+                        movie_events[movie_num_events++] = event;
+                }
+                else if (type == 'H') {
+                        long frame;
+                        uint64_t hash;
+                        if (fscanf(movie, "%ld %" SCNx64, &frame, &hash) != 2 || frame != movie_num_hashes + 1) {
+                                break;
+                        }
+                        if (movie_num_hashes == hash_capacity) {
+                                hash_capacity *= 2;
+                                movie_hashes = realloc(movie_hashes, hash_capacity * sizeof(uint64_t));
+                        }
+                        movie_hashes[movie_num_hashes++] = hash;
+                }
+                else {
+                        break;
+                }
+        }
+        if (!feof(movie) || movie_num_hashes == 0) {
+                printf("Bad line in movie %s after frame %ld\n", filename, movie_num_hashes);
+                fclose(movie);
+                return -1;
+        }
+        fclose(movie);
+
+        movie_boot_rom = boot;
+        movie_next_event = 0;
+        movie_frames = 0;
+        movie_recording = false;
+        movie_active = true;
+        return 0;
+}
+
+/*
+ * Whether the movie starts from the boot rom
+ */
+bool
+movie_boot()
+{
+        return movie_boot_rom;
+}
+
+/*
+ * Frames in the movie being played
+ */
+long
+movie_length()
+{
+        return movie_num_hashes;
+}
+
+/*
+ * Called from key_press/key_release. Records the key, or during playback
+ * returns true to drop keys that aren't from the movie
+ */
+bool
+movie_key(uint8_t key, bool pressed)
+{
+        if (movie_recording) {
+                fprintf(movie_file, "K %" PRIu64 " %c %02x\n", get_cycles(), pressed ? 'P' : 'R', key);
+                return false;
+        }
+        return !movie_applying;
+}
+
+/*
+ * Apply the keys due by now, call before each frame
+ */
+void
+movie_input()
+{
+        if (!movie_active || movie_recording) {
+                return;
+        }
+        movie_applying = true;
+        while (movie_next_event < movie_num_events && movie_events[movie_next_event].cycle <= get_cycles()) {
+                struct movie_event *event = &movie_events[movie_next_event++];
+                if (event->pressed) {
+                        key_press(event->key);
+                }
+                else {
+                        key_release(event->key);
+                }
+        }
+        movie_applying = false;
+}
+
+/*
+ * Record or check the hash of the frame just run, call after each frame.
+ * Playback ends (handing input back to the frontend) at the end of the movie
+ * or at the first mismatch, which returns -1
+ */
+int
+movie_frame()
+{
+        if (!movie_active) {
+                return 0;
+        }
+        movie_frames++;
+        if (movie_recording) {
+                fprintf(movie_file, "H %ld %016" PRIx64 "\n", movie_frames, hash_frame());
+                return 0;
+        }
+
+        if (movie_hashes[movie_frames - 1] != hash_frame()) {
+                printf("Movie desynced at frame %ld\n", movie_frames);
+                close_movie();
+                return -1;
+        }
+        if (movie_frames == movie_num_hashes) {
+                if (verbose) {
+                        printf("Movie finished, %ld frames matched\n", movie_frames);
+                }
+                close_movie();
+        }
+        return 0;
+}
+
+/*
+ * Finish recording or stop playback
+ */
+void
+close_movie()
+{
+        if (!movie_active) {
+                return;
+        }
+        if (movie_recording) {
+                fclose(movie_file);
+        }
+        else {
+                free(movie_events);
+                free(movie_hashes);
+        }
+        movie_active = false;
+        movie_recording = false;
+}
@@ -0,0 +1,28 @@
+#include <unistd.h>
+
+/*
+ *      Hook for key_press/key_release, true drops the key (live input during
+ *      playback)
+ */
+extern bool movie_active;
+
+#define MOVIE_KEY(key, pressed) do { \
+        if (movie_active && movie_key((key), (pressed))) return; \
+} while (0)
+
+/*
+ *      Function headers
+ */
+int record_movie(char *filename, bool boot);
+int play_movie(char *filename);
+bool movie_boot();
+long movie_length();
+bool movie_key(uint8_t key, bool pressed);
+void movie_input();
+int movie_frame();
+void close_movie();
+
+/*
+ *      Constants definitions
+ */
+#define MOVIE_VERSION 2         // 2: xxHash64 frame hashes
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "gb_profile.h"
+
+/*
+ *      Execution profile
+ *
+ *      Executions and cycles per opcode and per CB opcode, and accesses per
+ *      memory region. Memory counts cover every read_mem and write_mem, which
+ *      is the CPU's accesses only: the renderer reads VRAM directly and OAM
+ *      DMA copies its source page in bulk. The counters are plain arrays
+ *      bumped from macros in gb_cpu.c, so a profiled build costs a few
+ *      increments per instruction and a normal build nothing at all.
+ *
+ *      Saved as JSON if the filename ends in .json, otherwise CSV with the
+ *      columns section,key,count,cycles.
+ */
+
+#ifdef GB_PROFILE
+uint64_t profile_op_count[256];
+uint64_t profile_op_cycles[256];
+uint64_t profile_cb_count[256];
+uint64_t profile_cb_cycles[256];
+uint64_t profile_reads[PROFILE_REGIONS];
+uint64_t profile_writes[PROFILE_REGIONS];
+
+// Region of every 256 byte page, HRAM is split off the last one by PROFILE_REGION
+const uint8_t profile_page_region[256] = {
+        [0x00 ... 0x3F] = PROFILE_ROM0,
+        [0x40 ... 0x7F] = PROFILE_ROMX,
+        [0x80 ... 0x9F] = PROFILE_VRAM,
+        [0xA0 ... 0xBF] = PROFILE_ERAM,
+        [0xC0 ... 0xFD] = PROFILE_WRAM,         // Echo RAM included
+        [0xFE] = PROFILE_OAM,
+        [0xFF] = PROFILE_IO,
+};
+
+char *profile_region_names[PROFILE_REGIONS] = {"ROM0", "ROMX", "VRAM", "ERAM", "WRAM", "OAM", "IO", "HRAM"};
+
+static void
+write_csv(FILE *out)
+{
+        fprintf(out, "section,key,count,cycles\n");
+        for (int i = 0; i < 256; i++) {
+                if (profile_op_count[i]) {
+                        fprintf(out, "op,%02X,%" PRIu64 ",%" PRIu64 "\n", i, profile_op_count[i], profile_op_cycles[i]);
+                }
+        }
+        for (int i = 0; i < 256; i++) {
+                if (profile_cb_count[i]) {
+                        fprintf(out, "cb,%02X,%" PRIu64 ",%" PRIu64 "\n", i, profile_cb_count[i], profile_cb_cycles[i]);
+                }
+        }
+        for (int i = 0; i < PROFILE_REGIONS; i++) {
+                fprintf(out, "read,%s,%" PRIu64 ",\n", profile_region_names[i], profile_reads[i]);
+                fprintf(out, "write,%s,%" PRIu64 ",\n", profile_region_names[i], profile_writes[i]);
+        }
+}
+
+static void
+write_json_ops(FILE *out, char *name, uint64_t *count, uint64_t *cycles)
+{
+        fprintf(out, "  \"%s\": {", name);
+        bool first = true;
+        for (int i = 0; i < 256; i++) {
+                if (count[i]) {
+                        fprintf(out, "%s\n    \"%02X\": {\"count\": %" PRIu64 ", \"cycles\": %" PRIu64 "}",
+                                first ? "" : ",", i, count[i], cycles[i]);
+                        first = false;
+                }
+        }
+        fprintf(out, "\n  },\n");
+}
+
+static void
+write_json(FILE *out)
+{
+        fprintf(out, "{\n");
+        write_json_ops(out, "opcodes", profile_op_count, profile_op_cycles);
+        write_json_ops(out, "cb", profile_cb_count, profile_cb_cycles);
+        fprintf(out, "  \"regions\": {");
+        for (int i = 0; i < PROFILE_REGIONS; i++) {
+                fprintf(out, "%s\n    \"%s\": {\"reads\": %" PRIu64 ", \"writes\": %" PRIu64 "}",
+                        i ? "," : "", profile_region_names[i], profile_reads[i], profile_writes[i]);
+        }
+        fprintf(out, "\n  }\n}\n");
+}
+#endif
+
+/*
+ * Write the counters so far, returns -1 on error or if profiling isn't built in
+ */
+int
+save_profile(char *filename)
+{
+#ifdef GB_PROFILE
+        FILE *out = fopen(filename, "w");
+        if (out == NULL) {
+                printf("Error opening profile output %s\n", filename);
+                return -1;
+        }
+        size_t length = strlen(filename);
+        if (length >= 5 && strcmp(filename + length - 5, ".json") == 0) {
+                write_json(out);
+        }
+        else {
+                write_csv(out);
+        }
+        fclose(out);
+        return 0;
+#else
+        (void) filename;
+        printf("Profiling not built in, rebuild with -DGB_PROFILE\n");
+        return -1;
+#endif
+}
+
+/*
+ * Clear the counters, to profile a section of a run
+ */
+void
+reset_profile()
+{
+#ifdef GB_PROFILE
+        memset(profile_op_count, 0, sizeof(profile_op_count));
+        memset(profile_op_cycles, 0, sizeof(profile_op_cycles));
+        memset(profile_cb_count, 0, sizeof(profile_cb_count));
+        memset(profile_cb_cycles, 0, sizeof(profile_cb_cycles));
+        memset(profile_reads, 0, sizeof(profile_reads));
+        memset(profile_writes, 0, sizeof(profile_writes));
+#endif
+}
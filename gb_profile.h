@@ -0,0 +1,42 @@
+#include <unistd.h>
+
+/*
+ *      Execution counters, compiled in with -DGB_PROFILE. Without it the
+ *      hooks expand to nothing and the core is unchanged
+ */
+#define PROFILE_ROM0 0
+#define PROFILE_ROMX 1
+#define PROFILE_VRAM 2
+#define PROFILE_ERAM 3
+#define PROFILE_WRAM 4
+#define PROFILE_OAM 5                   // Including the unusable area after it
+#define PROFILE_IO 6                    // Including IE at FFFF
+#define PROFILE_HRAM 7
+#define PROFILE_REGIONS 8
+
+#ifdef GB_PROFILE
+extern uint64_t profile_op_count[256];
+extern uint64_t profile_op_cycles[256];
+extern uint64_t profile_cb_count[256];
+extern uint64_t profile_cb_cycles[256];
+extern uint64_t profile_reads[PROFILE_REGIONS];
+extern uint64_t profile_writes[PROFILE_REGIONS];
+extern const uint8_t profile_page_region[256];
+
+#define PROFILE_OP(op, cycles) (profile_op_count[op]++, profile_op_cycles[op] += (cycles))
+#define PROFILE_CB(op, cycles) (profile_cb_count[op]++, profile_cb_cycles[op] += (cycles))
+#define PROFILE_REGION(addr) ((addr) >= 0xFF80 && (addr) != 0xFFFF ? PROFILE_HRAM : profile_page_region[(addr) >> 8])
+#define PROFILE_READ(addr) (profile_reads[PROFILE_REGION(addr)]++)
+#define PROFILE_WRITE(addr) (profile_writes[PROFILE_REGION(addr)]++)
+#else
+#define PROFILE_OP(op, cycles)
+#define PROFILE_CB(op, cycles)
+#define PROFILE_READ(addr)
+#define PROFILE_WRITE(addr)
+#endif
+
+/*
+ *      Function headers
+ */
+int save_profile(char *filename);
+void reset_profile();
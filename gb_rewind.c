@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "gb_state.h"
+#include "gb_rewind.h"
+
+/*
+ *      Rewind buffer
+ *
+ *      Every interval frames the machine is saved with save_state_mem and
+ *      stored in a circular byte arena. Every REWIND_KEY_INTERVAL snapshots
+ *      is a keyframe, the rest are XORed against the last keyframe. WRAM and
+ *      VRAM barely change between frames so the XOR is almost all zero, and
+ *      is stored as runs of zero words and literal words:
+ *
+ *              <zero words> <literal words> <literals>...
+ *
+ *      with the counts as LEB128 varints. Keyframes use the same codec against
+ *      an all zero state. Both work on 64 bit words, which is the padding the
+ *      state regions are aligned to, so a snapshot is one copy and one pass.
+ *
+ *      When the arena is full the oldest entries are dropped. Deltas are
+ *      useless without their keyframe, so they go along with it.
+ */
+
+struct rewind_entry {
+        uint32_t offset;        // Position in the arena
+        uint32_t length;
+        uint32_t serial;        // Snapshot number
+        bool keyframe;
+};
+
+struct rewind_entry rewind_entries[REWIND_MAX_ENTRIES];
+uint32_t rewind_first = 0;
+uint32_t rewind_count = 0;
+
+uint8_t *rewind_arena = NULL;
+uint32_t rewind_arena_size;
+uint32_t rewind_write_pos = 0;
+
+uint32_t rewind_words;           // State size in 64 bit words
+uint64_t *rewind_key;            // Uncompressed last keyframe
+uint64_t *rewind_zero;
+uint64_t *rewind_scratch;
+uint8_t *rewind_encoded;         // Worst case encoding of one snapshot
+
+uint32_t rewind_interval;
+uint32_t rewind_frame_count = 0;
+uint32_t rewind_serial = 0;
+uint32_t rewind_key_serial = 0;
+bool rewind_need_key = true;
+
+/*
+ * Allocate the history, interval is in frames
+ */
+int
+init_rewind(uint32_t interval, uint32_t buffer_size)
+{
+        rewind_words = state_size() / 8;
+        rewind_interval = interval ? interval : 1;
+        rewind_arena_size = buffer_size;
+        rewind_arena = malloc(rewind_arena_size);
+        rewind_key = malloc(rewind_words * 8);
+        rewind_zero = calloc(rewind_words, 8);
+        rewind_scratch = malloc(rewind_words * 8);
+        // Two varints of at most 5 bytes per literal word
+        rewind_encoded = malloc(rewind_words * 18 + 16);
+        if (rewind_arena == NULL || rewind_key == NULL || rewind_zero == NULL ||
+            rewind_scratch == NULL || rewind_encoded == NULL) {
+                printf("Error allocating rewind buffer\n");
+                close_rewind();
+                return -1;
+        }
+        if (rewind_arena_size < rewind_words * 18 + 16) {
+                printf("Rewind buffer too small\n");
+                close_rewind();
+                return -1;
+        }
+        rewind_first = 0;
+        rewind_count = 0;
+        rewind_write_pos = 0;
+        rewind_frame_count = 0;
+        rewind_need_key = true;
+        return 0;
+}
+
+void
+close_rewind()
+{
+        free(rewind_arena);
+        free(rewind_key);
+        free(rewind_zero);
+        free(rewind_scratch);
+        free(rewind_encoded);
+        rewind_arena = NULL;
+        rewind_count = 0;
+}
+
+static uint8_t *
+put_varint(uint8_t *out, uint32_t value)
+{
+        while (value >= 0x80) {
+                *out++ = value | 0x80;
+                value >>= 7;
+        }
+        *out++ = value;
+        return out;
+}
+
+static const uint8_t *
+get_varint(const uint8_t *in, uint32_t *value)
+{
+        uint32_t result = 0;
+        int shift = 0;
+        while (*in & 0x80) {
+                result |= (*in++ & 0x7F) << shift;
+                shift += 7;
+        }
+        *value = result | (*in++ << shift);
+        return in;
+}
+
+/*
+ * Encode state XOR base into rewind_encoded, returns the length
+ */
+static uint32_t
+encode_state(const uint64_t *state, const uint64_t *base)
+{
+        uint8_t *out = rewind_encoded;
+        uint32_t i = 0;
+        while (i < rewind_words) {
+                uint32_t start = i;
+                while (i < rewind_words && state[i] == base[i]) {
+                        i++;
+                }
+                uint32_t zeros = i - start;
+                start = i;
+                while (i < rewind_words && state[i] != base[i]) {
+                        i++;
+                }
+                out = put_varint(out, zeros);
+                out = put_varint(out, i - start);
+                for (uint32_t j = start; j < i; j++) {
+                        uint64_t delta = state[j] ^ base[j];
+                        memcpy(out, &delta, 8);
+                        out += 8;
+                }
+        }
+        return out - rewind_encoded;
+}
+
+/*
+ * XOR an encoded entry into state
+ */
+static void
+decode_state(uint64_t *state, const uint8_t *in, uint32_t length)
+{
+        const uint8_t *end = in + length;
+        uint32_t i = 0;
+        while (in < end) {
+                uint32_t zeros, literals;
+                in = get_varint(in, &zeros);
+                in = get_varint(in, &literals);
+                i += zeros;
+                for (uint32_t j = 0; j < literals; j++) {
+                        uint64_t delta;
+                        memcpy(&delta, in, 8);
+                        state[i++] ^= delta;
+                        in += 8;
+                }
+        }
+}
+
+static struct rewind_entry *
+entry_at(uint32_t index)
+{
+        return &rewind_entries[(rewind_first + index) % REWIND_MAX_ENTRIES];
+}
+
+/*
+ * Drop the oldest entry, and any deltas that relied on it
+ */
+static void
+drop_oldest()
+{
+        do {
+                if (rewind_entries[rewind_first].serial == rewind_key_serial) {
+                        rewind_need_key = true;
+                }
+                rewind_first = (rewind_first + 1) % REWIND_MAX_ENTRIES;
+                rewind_count--;
+        } while (rewind_count && !rewind_entries[rewind_first].keyframe);
+}
+
+/*
+ * Reserve length bytes in the arena, dropping old entries in the way
+ */
+static uint32_t
+allocate(uint32_t length)
+{
+        if (rewind_write_pos + length > rewind_arena_size) {
+                // Wrap around, everything left at the end is the oldest
+                while (rewind_count && rewind_entries[rewind_first].offset >= rewind_write_pos) {
+                        drop_oldest();
+                }
+                rewind_write_pos = 0;
+        }
+        while (rewind_count && rewind_entries[rewind_first].offset < rewind_write_pos + length &&
+               rewind_entries[rewind_first].offset + rewind_entries[rewind_first].length > rewind_write_pos) {
+                drop_oldest();
+        }
+        if (rewind_count == REWIND_MAX_ENTRIES) {
+                drop_oldest();
+        }
+        uint32_t offset = rewind_write_pos;
+        rewind_write_pos += length;
+        return offset;
+}
+
+/*
+ * Take a snapshot if one is due, call once per frame
+ */
+void
+rewind_snapshot()
+{
+        if (rewind_arena == NULL || rewind_frame_count++ % rewind_interval) {
+                return;
+        }
+
+        save_state_mem((uint8_t *) rewind_scratch);
+        bool keyframe = rewind_need_key || rewind_serial - rewind_key_serial >= REWIND_KEY_INTERVAL;
+        uint32_t length;
+        if (keyframe) {
+                length = encode_state(rewind_scratch, rewind_zero);
+        }
+        else {
+                length = encode_state(rewind_scratch, rewind_key);
+        }
+
+        uint32_t offset = allocate(length);
+        if (!keyframe && rewind_need_key) {
+                // Making room dropped our keyframe, and with it all history
+                keyframe = true;
+                length = encode_state(rewind_scratch, rewind_zero);
+                offset = allocate(length);
+        }
+        if (keyframe) {
+                memcpy(rewind_key, rewind_scratch, rewind_words * 8);
+                rewind_key_serial = rewind_serial;
+                rewind_need_key = false;
+        }
+        memcpy(rewind_arena + offset, rewind_encoded, length);
+
+        struct rewind_entry *entry = entry_at(rewind_count++);
+        entry->offset = offset;
+        entry->length = length;
+        entry->serial = rewind_serial++;
+        entry->keyframe = keyframe;
+}
+
+/*
+ * Go back the given number of snapshots (1 is the newest) and load it.
+ * Newer snapshots are discarded. Returns -1 if there isn't that much history
+ */
+int
+rewind_state(uint32_t snapshots)
+{
+        if (snapshots == 0 || snapshots > rewind_count) {
+                return -1;
+        }
+        uint32_t target = rewind_count - snapshots;
+        uint32_t key = target;
+        while (!entry_at(key)->keyframe) {
+                key--;
+        }
+
+        struct rewind_entry *entry = entry_at(key);
+        memset(rewind_key, 0, rewind_words * 8);
+        decode_state(rewind_key, rewind_arena + entry->offset, entry->length);
+        rewind_key_serial = entry->serial;
+
+        entry = entry_at(target);
+        memcpy(rewind_scratch, rewind_key, rewind_words * 8);
+        if (target != key) {
+                decode_state(rewind_scratch, rewind_arena + entry->offset, entry->length);
+        }
+        if (load_state_mem((uint8_t *) rewind_scratch, rewind_words * 8) == -1) {
+                return -1;
+        }
+
+        // The target is taken again by the next snapshot
+        rewind_write_pos = entry->offset;
+        rewind_serial = entry->serial;
+        rewind_count = target;
+        rewind_frame_count = 0;
+        rewind_need_key = target == key;
+        return 0;
+}
+
+/*
+ * Number of snapshots held
+ */
+uint32_t
+rewind_depth()
+{
+        return rewind_count;
+}
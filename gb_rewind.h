@@ -0,0 +1,17 @@
+#include <unistd.h>
+
+/*
+ *      Function headers
+ */
+int init_rewind(uint32_t interval, uint32_t buffer_size);
+void rewind_snapshot();
+int rewind_state(uint32_t snapshots);
+uint32_t rewind_depth();
+void close_rewind();
+
+/*
+ *      Constants definitions
+ */
+#define REWIND_BUFFER_SIZE (4 << 20)    // Default history size in bytes
+#define REWIND_KEY_INTERVAL 64          // Snapshots per keyframe
+#define REWIND_MAX_ENTRIES 16384
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_rom.h"
+
+// Rom reading
+uint8_t *load_rom;           // ROM from cartridge
+uint8_t *load_save;             // Save file
+bool has_save = false;                 // Whether to load a save file
+int cartridge_type; // Cartridge banking type
+char *cartridge_types[] = {"ROM ONLY", "MBC1", "MBC2", "MBC3"};
+// Saving read rom/ram sizes
+uint32_t rom_size;
+uint32_t ram_size;
+int num_banks;              // Number of rom banks, a power of two
+int rom_quirks;             // QUIRK_ flags for the mapper
+
+/*
+ * Sum of len bytes, eight at a time. Each word is split into 16-bit lanes
+ * that can take 128 words before overflowing, then the lanes are folded
+ */
+static uint32_t
+sum_bytes(const uint8_t *data, size_t len)
+{
+        const uint64_t bytes = 0x00FF00FF00FF00FFull;
+        uint32_t sum = 0;
+        size_t i = 0;
+        while (len - i >= 8) {
+                size_t words = (len - i) / 8 < 128 ? (len - i) / 8 : 128;
+                uint64_t lanes = 0;
+                for (size_t w = 0; w < words; w++, i += 8) {
+                        uint64_t word;
+                        memcpy(&word, data + i, 8);
+                        lanes += (word & bytes) + ((word >> 8) & bytes);
+                }
+                lanes = (lanes & 0x0000FFFF0000FFFFull) + ((lanes >> 16) & 0x0000FFFF0000FFFFull);
+                sum += (uint32_t) lanes + (uint32_t) (lanes >> 32);
+        }
+        for (; i < len; i++) {
+                sum += data[i];
+        }
+        return sum;
+}
+
+/*
+ * Mapper quirks the header can't describe, detected from the ROM itself
+ */
+static void
+find_quirks(long fsize)
+{
+        rom_quirks = 0;
+
+        // A banked ROM with a ROM only header, as some homebrew ships, runs as MBC1
+        if (cartridge_type == 0 && num_banks > 2) {
+                if (verbose) printf("ROM only header on a %d bank ROM, using MBC1\n", num_banks);
+                cartridge_type = 1;
+        }
+
+        // MBC1 multicarts repeat the header logo at bank 0x10 and wire only
+        // four bits of the low bank register
+        if (cartridge_type == 1 && fsize == 0x100000 &&
+            memcmp(load_rom + 0x104, load_rom + 0x40104, 0x30) == 0) {
+                if (verbose) printf("MBC1 multicart\n");
+                rom_quirks |= QUIRK_MBC1M;
+        }
+}
+
+/*
+ *   Read the provided ROM and parse out the cartridge header data. A bad
+ *   header checksum is only refused when the boot ROM will run.
+ */
+int
+read_rom(char *filename, bool boot)
+{
+        FILE *rom_file = fopen(filename, "rb");
+
+        // Output error if file missing
+        if (rom_file == NULL) {
+                printf("Error opening provided filename\n");
+                return -1;
+        }
+
+        // The size comes from the file, padded to a power of two banks with
+        // open bus so every bank the mapper can select is inside the buffer
+        fseek(rom_file, 0, SEEK_END);
+        long fsize = ftell(rom_file);
+        fseek(rom_file, 0, SEEK_SET); 
+        if (fsize < ROM_HEADER_END || fsize > MAX_ROM_SIZE) {
+                printf("ROM size %ld is outside %d-%d bytes\n", fsize, ROM_HEADER_END, MAX_ROM_SIZE);
+                fclose(rom_file);
+                return -1;
+        }
+        num_banks = 2;
+        while ((long) num_banks * ROM_BANK_SIZE < fsize) {
+                num_banks *= 2;
+        }
+        rom_size = num_banks * ROM_BANK_SIZE;
+        load_rom = (uint8_t*)malloc(rom_size);
+        if (load_rom == NULL || fread(load_rom, fsize, 1, rom_file) != 1) {
+                printf("Error reading ROM\n");
+                fclose(rom_file);
+                goto fail;
+        }
+        fclose(rom_file);
+        memset(load_rom + fsize, 0xFF, rom_size - fsize);
+
+        // Header checksum, the boot ROM locks up if it's wrong
+        uint8_t header = 0;
+        for (int i = 0x134; i <= 0x14C; i++) {
+                header = header - load_rom[i] - 1;
+        }
+        if (header != load_rom[0x14D]) {
+                printf("Bad header checksum %02X, expected %02X\n", load_rom[0x14D], header);
+                if (boot) {
+                        printf("The boot ROM would lock up, run with -b to skip it\n");
+                        goto fail;
+                }
+        }
+
+        // Global checksum, which nothing on the console checks
+        uint16_t global = sum_bytes(load_rom, fsize) - load_rom[0x14E] - load_rom[0x14F];
+        if (global != ((load_rom[0x14E] << 8) | load_rom[0x14F]) && verbose) {
+                printf("Global checksum %04X doesn't match the header\n", global);
+        }
+
+        if (verbose) printf("Title %.16s\n", (char *) load_rom + 0x134);
+
+        // ROM Cartridge Type
+        switch (load_rom[0x147]) {
+                case 0:
+                cartridge_type = 0;
+                break;
+                case 1:
+                case 2:
+                case 3:
+                cartridge_type = 1;
+                break;
+                case 15:
+                case 16:
+                case 17:
+                case 18:
+                case 19:
+                cartridge_type = 3;
+                break;
+                default:
+                if (verbose) {
+                        printf("Unsupported ROM type\n");
+                }
+                goto fail;
+        }
+        find_quirks(fsize);
+        if (verbose) {
+                printf("The ROM has a %s cartridge type\n", cartridge_types[cartridge_type]);
+        }
+
+        // ROM Size, only compared with the file
+        if (load_rom[0x148] <= 0x8 && (ROM_BANK_SIZE * 2 << load_rom[0x148]) != fsize && verbose) {
+                printf("Header gives a ROM size of %X, the file has %lX\n",
+                       ROM_BANK_SIZE * 2 << load_rom[0x148], fsize);
+        }
+
+        if (verbose) printf("The ROM has size %X\n", rom_size);
+
+        // RAM Size
+        switch (load_rom[0x149]) {
+                case 0x0: ram_size = 0; break;
+                case 0x1: ram_size = 0x800; break;
+                case 0x2: ram_size = 0x2000; break;
+                case 0x3: ram_size = 0x8000; break;
+                case 0x4: ram_size = 0x20000; break;
+                case 0x5: ram_size = 0x10000; break;
+                default:
+                printf("Unknown RAM size %02X\n", load_rom[0x149]);
+                goto fail;
+        }
+
+        if (verbose) printf("The RAM has size %X\n", ram_size);
+
+        // TODO: save files
+        if (has_save) {
+                // Get save name
+                char save_name[100];
+                sprintf(save_name, filename);
+                // Replace .gb with .sav
+                char *suffix = strstr(save_name, ".gb");
+                if (suffix == NULL) {
+                        printf("Error with filename");
+                        goto fail;
+                }
+                sprintf(suffix, ".sav");
+                if (verbose) printf("Loading save at %s\n", save_name);
+                // Attempt to open file
+                FILE *save_file = fopen(save_name, "rb");
+                if (!save_file) {
+                        printf("Given save file does not exist\n");
+                        goto fail;
+                }
+                // Copying into memory
+                load_save = (uint8_t*)malloc(ram_size);
+                fread(load_save, ram_size, 1, save_file);
+                fclose(save_file);
+        }
+
+        // Returning without errors
+        return 0;
+
+fail:
+        // Leave nothing behind for a caller that tries another ROM
+        free(load_rom);
+        load_rom = NULL;
+        return -1;
+}
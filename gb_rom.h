@@ -0,0 +1,25 @@
+#include <unistd.h>
+
+/*
+ * Shared variables
+ */
+extern uint8_t *load_rom;       // ROM from cartridge
+extern uint8_t *load_save;      // Save file
+extern bool has_save;           // Whether to load a save file
+extern int cartridge_type;      // Cartridge banking type
+extern uint32_t rom_size;
+extern uint32_t ram_size;
+extern int num_banks;           // Number of rom banks, a power of two
+extern int rom_quirks;          // QUIRK_ flags for the mapper
+
+/*
+ * Function headers
+ */
+int read_rom(char *filename, bool boot);
+
+/*
+ * Constants definitions
+ */
+#define ROM_HEADER_END 0x150
+#define MAX_ROM_SIZE 0x800000
+#define QUIRK_MBC1M 0x1         // MBC1 multicart, 4 bit low bank register
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_sampler.h"
+
+/*
+ *      Sampling profiler
+ *
+ *      Every period cycles the guest's (ROM bank, PC) is recorded together
+ *      with its call stack, counted in a hash table of distinct stacks. The
+ *      stack is tracked from CALL, RST and interrupt dispatch (push) and RET
+ *      and RETI (pop). Games leave routines without returning, so every frame
+ *      remembers SP after its call, and a return unwinds every frame at or
+ *      below its SP instead of trusting the calls and returns to pair up.
+ *
+ *      The result is written as folded stacks, one "outer;inner;leaf count"
+ *      line per stack, as read by flamegraph.pl and speedscope. Locations are
+ *      named from an RGBDS .sym file when there is one (by the closest label
+ *      at or before them), otherwise printed as bank:address.
+ */
+
+struct sampler_frame {
+        uint32_t location;      // Bank << 16 | address
+        uint16_t sp;            // SP just after the call
+};
+
+struct sampler_slot {
+        uint64_t hash;
+        uint32_t count;         // 0 for a free slot
+        uint32_t offset;        // Locations in sampler_pool, outermost first
+        uint8_t length;
+};
+
+struct sampler_symbol {
+        uint32_t location;
+        char *name;
+};
+
+bool sampler_active = false;
+int32_t sampler_countdown;
+uint32_t sampler_period;
+
+struct sampler_frame sampler_stack[SAMPLER_DEPTH];
+int sampler_depth = 0;
+
+struct sampler_slot *sampler_slots;
+uint32_t sampler_used = 0;
+uint32_t *sampler_pool;
+uint32_t sampler_pool_used = 0;
+uint32_t sampler_pool_size = 0;
+long sampler_lost = 0;          // Samples dropped with the table full
+
+struct sampler_symbol *sampler_symbols = NULL;
+int sampler_num_symbols = 0;
+
+static uint32_t
+location(uint16_t addr)
+{
+        if (addr >= 0x4000 && addr < 0x8000) {
+                return (get_rom_bank() << 16) | addr;
+        }
+        return addr;
+}
+
+static int
+compare_symbols(const void *a, const void *b)
+{
+        uint32_t x = ((const struct sampler_symbol *) a)->location;
+        uint32_t y = ((const struct sampler_symbol *) b)->location;
+        return (x > y) - (x < y);
+}
+
+/*
+ * Read "bank:address label" lines from an RGBDS symbol file
+ */
+static int
+read_symbols(char *filename)
+{
+        FILE *sym_file = fopen(filename, "r");
+        if (sym_file == NULL) {
+                printf("Error opening symbol file %s\n", filename);
+                return -1;
+        }
+        char line[512];
+        char name[256];
+        unsigned bank, addr;
+        int capacity = 1024;
+        sampler_symbols = malloc(capacity * sizeof(struct sampler_symbol));
+        while (fgets(line, sizeof(line), sym_file)) {
+                if (sscanf(line, "%x:%x %255s", &bank, &addr, name) != 3 || line[0] == ';') {
+                        continue;
+                }
+                if (sampler_num_symbols == capacity) {
+                        capacity *= 2;
+                        sampler_symbols = realloc(sampler_symbols, capacity * sizeof(struct sampler_symbol));
+                }
+                // Bank 0 and RAM are recorded without a bank
+                if (addr < 0x4000 || addr >= 0x8000) {
+                        bank = 0;
+                }
+                sampler_symbols[sampler_num_symbols].location = (bank << 16) | addr;
+                sampler_symbols[sampler_num_symbols].name = strdup(name);
+                sampler_num_symbols++;
+        }
+        fclose(sym_file);
+        qsort(sampler_symbols, sampler_num_symbols, sizeof(struct sampler_symbol), compare_symbols);
+        if (verbose) printf("Read %d symbols from %s\n", sampler_num_symbols, filename);
+        return 0;
+}
+
+/*
+ * The .sym file next to a ROM (game.gb -> game.sym), or NULL if there is none
+ */
+char *
+find_symbols(char *rom_filename)
+{
+        char *sym_filename = malloc(strlen(rom_filename) + 5);
+        strcpy(sym_filename, rom_filename);
+        char *dot = strrchr(sym_filename, '.');
+        if (dot == NULL || strchr(dot, '/')) {
+                dot = sym_filename + strlen(sym_filename);
+        }
+        strcpy(dot, ".sym");
+        if (access(sym_filename, R_OK) != 0) {
+                free(sym_filename);
+                return NULL;
+        }
+        return sym_filename;
+}
+
+/*
+ * Start sampling every period cycles, sym_filename may be NULL
+ */
+int
+init_sampler(uint32_t period, char *sym_filename)
+{
+        if (sym_filename && read_symbols(sym_filename) == -1) {
+                return -1;
+        }
+        sampler_slots = calloc(SAMPLER_SLOTS, sizeof(struct sampler_slot));
+        sampler_pool_size = 1 << 16;
+        sampler_pool = malloc(sampler_pool_size * sizeof(uint32_t));
+        if (sampler_slots == NULL || sampler_pool == NULL) {
+                printf("Error allocating sampler\n");
+                return -1;
+        }
+        sampler_period = period ? period : SAMPLER_PERIOD;
+        sampler_countdown = sampler_period;
+        sampler_depth = 0;
+        sampler_active = true;
+        return 0;
+}
+
+/*
+ * PC has just been set to a call target, and SP holds the return address
+ */
+void
+sampler_call()
+{
+        if (sampler_depth == SAMPLER_DEPTH) {
+                return;
+        }
+        sampler_stack[sampler_depth].location = location(PC);
+        sampler_stack[sampler_depth].sp = SP;
+        sampler_depth++;
+}
+
+/*
+ * About to return through the address at SP
+ */
+void
+sampler_return()
+{
+        uint16_t sp = SP;
+        while (sampler_depth && sampler_stack[sampler_depth - 1].sp <= sp) {
+                sampler_depth--;
+        }
+}
+
+/*
+ * Count the current stack
+ */
+void
+sampler_sample()
+{
+        sampler_countdown += sampler_period;
+
+        uint32_t leaf = location(PC);
+        uint64_t hash = 0xCBF29CE484222325;
+        for (int i = 0; i < sampler_depth; i++) {
+                hash = (hash ^ sampler_stack[i].location) * 0x100000001B3;
+        }
+        hash = (hash ^ leaf) * 0x100000001B3;
+
+        uint32_t slot = hash & (SAMPLER_SLOTS - 1);
+        while (sampler_slots[slot].count) {
+                struct sampler_slot *entry = &sampler_slots[slot];
+                if (entry->hash == hash && entry->length == sampler_depth + 1) {
+                        entry->count++;
+                        return;
+                }
+                slot = (slot + 1) & (SAMPLER_SLOTS - 1);
+        }
+
+        // New stack, keep the table at most 3/4 full
+        if (sampler_used >= SAMPLER_SLOTS / 4 * 3) {
+                sampler_lost++;
+                return;
+        }
+        if (sampler_pool_used + sampler_depth + 1 > sampler_pool_size) {
+                sampler_pool_size *= 2;
+                sampler_pool = realloc(sampler_pool, sampler_pool_size * sizeof(uint32_t));
+        }
+        struct sampler_slot *entry = &sampler_slots[slot];
+        entry->hash = hash;
+        entry->count = 1;
+        entry->offset = sampler_pool_used;
+        entry->length = sampler_depth + 1;
+        for (int i = 0; i < sampler_depth; i++) {
+                sampler_pool[sampler_pool_used++] = sampler_stack[i].location;
+        }
+        sampler_pool[sampler_pool_used++] = leaf;
+        sampler_used++;
+}
+
+struct sampler_line {
+        char *text;
+        uint32_t count;
+};
+
+/*
+ * Append the name of the label containing a location
+ */
+static int
+print_location(char *out, size_t size, uint32_t loc)
+{
+        int low = 0;
+        int high = sampler_num_symbols - 1;
+        int found = -1;
+        while (low <= high) {
+                int mid = (low + high) / 2;
+                if (sampler_symbols[mid].location <= loc) {
+                        found = mid;
+                        low = mid + 1;
+                }
+                else {
+                        high = mid - 1;
+                }
+        }
+        if (found != -1 && (sampler_symbols[found].location >> 16) == (loc >> 16)) {
+                return snprintf(out, size, "%s", sampler_symbols[found].name);
+        }
+        return snprintf(out, size, "%02X:%04X", loc >> 16, loc & 0xFFFF);
+}
+
+static int
+compare_lines(const void *a, const void *b)
+{
+        return strcmp(((const struct sampler_line *) a)->text, ((const struct sampler_line *) b)->text);
+}
+
+/*
+ * Write the samples so far as folded stacks. Stacks that only differ
+ * within a label name the same, so those are merged
+ */
+int
+save_samples(char *filename)
+{
+        FILE *out = fopen(filename, "w");
+        if (out == NULL) {
+                printf("Error opening sample output %s\n", filename);
+                return -1;
+        }
+
+        struct sampler_line *lines = malloc(MAX(sampler_used, 1) * sizeof(struct sampler_line));
+        uint32_t num_lines = 0;
+        char text[(SAMPLER_DEPTH + 1) * 260];    // Labels are at most 255 characters
+        for (uint32_t slot = 0; slot < SAMPLER_SLOTS; slot++) {
+                struct sampler_slot *entry = &sampler_slots[slot];
+                if (!entry->count) {
+                        continue;
+                }
+                size_t length = 0;
+                for (int i = 0; i < entry->length; i++) {
+                        if (i) {
+                                text[length++] = ';';
+                        }
+                        length += print_location(text + length, sizeof(text) - length,
+                                                 sampler_pool[entry->offset + i]);
+                }
+                lines[num_lines].text = strdup(text);
+                lines[num_lines].count = entry->count;
+                num_lines++;
+        }
+
+        qsort(lines, num_lines, sizeof(struct sampler_line), compare_lines);
+        for (uint32_t i = 0; i < num_lines; i++) {
+                uint64_t count = lines[i].count;
+                while (i + 1 < num_lines && strcmp(lines[i].text, lines[i + 1].text) == 0) {
+                        free(lines[i].text);
+                        count += lines[++i].count;
+                }
+                fprintf(out, "%s %lu\n", lines[i].text, (unsigned long) count);
+                free(lines[i].text);
+        }
+        free(lines);
+        fclose(out);
+
+        if (sampler_lost) {
+                printf("Sampler table full, %ld samples dropped\n", sampler_lost);
+        }
+        return 0;
+}
+
+void
+close_sampler()
+{
+        sampler_active = false;
+        free(sampler_slots);
+        free(sampler_pool);
+        for (int i = 0; i < sampler_num_symbols; i++) {
+                free(sampler_symbols[i].name);
+        }
+        free(sampler_symbols);
+        sampler_slots = NULL;
+        sampler_pool = NULL;
+        sampler_symbols = NULL;
+        sampler_num_symbols = 0;
+}
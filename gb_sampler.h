@@ -0,0 +1,31 @@
+#include <unistd.h>
+
+/*
+ *      Hooks for the core, cheap tests of a flag while the sampler is off
+ */
+extern bool sampler_active;
+extern int32_t sampler_countdown;
+
+#define SAMPLER_CALL() do { if (sampler_active) sampler_call(); } while (0)
+#define SAMPLER_RET() do { if (sampler_active) sampler_return(); } while (0)
+#define SAMPLER_TICK(cycles) do { \
+        if (sampler_active && (sampler_countdown -= (cycles)) <= 0) sampler_sample(); \
+} while (0)
+
+/*
+ *      Function headers
+ */
+int init_sampler(uint32_t period, char *sym_filename);
+char *find_symbols(char *rom_filename);
+void sampler_call();
+void sampler_return();
+void sampler_sample();
+int save_samples(char *filename);
+void close_sampler();
+
+/*
+ *      Constants definitions
+ */
+#define SAMPLER_PERIOD 1024             // Cycles between samples, about 4 kHz
+#define SAMPLER_DEPTH 64                // Deepest call stack tracked
+#define SAMPLER_SLOTS 65536             // Distinct stacks held
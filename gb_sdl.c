@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <SDL.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "gb_gpu.h"
+#include "gb_sdl.h"
+#include "gb_timing.h"
+
+/*
+ *      SDL display, the only part of the frontend that draws. The core only
+ *      fills graphics_raw, this converts and presents it
+ */
+
+// SDL elements
+SDL_Window *window;
+SDL_Renderer *renderer;
+SDL_Texture *texture;
+uint32_t graphics[144][160];
+
+// Frame time graph over the screen
+bool timing_overlay = false;
+
+/*
+ * Initialize SDL elements
+ */
+int
+init_SDL()
+{
+        // Initialize all SDL systems
+        if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
+                // Send message if fails
+                printf("error initializing SDL: %s\n", SDL_GetError());
+                return -1;
+        }
+        // Create parts of window (64 by 32 pixels)
+        window = SDL_CreateWindow("Gameboy", 
+                                        SDL_WINDOWPOS_CENTERED,
+                                        SDL_WINDOWPOS_CENTERED,
+                                        480, 432, 0);
+
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+        SDL_RenderSetLogicalSize(renderer, 160, 144);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255); 
+
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, 
+                                        SDL_TEXTUREACCESS_STREAMING, 160, 144);
+        return 1; // Return 1 when there is no problem
+}
+
+
+/*
+ * Update SDL elements
+ */
+uint32_t colors[4] = {0xFFFFFFFF, 0xAAAAAAAA, 0x55555555, 0x00000000};
+void update_SDL()
+{
+        // Filling pixels corresponding to graphics array
+        for (int i = 0; i < 144; i++) {
+                for (int j = 0; j < 160; j++) {
+                        graphics[i][j] = colors[graphics_raw[i][j]];
+                }
+        }
+        // Applying texture to screen
+        SDL_UpdateTexture(texture, NULL, graphics, 160 * sizeof(uint32_t));
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, NULL, NULL);
+        if (timing_overlay) {
+                draw_timing_overlay();
+        }
+        SDL_RenderPresent(renderer);
+}
+
+/*
+ * Stacked bars of the phases of the last 160 frames, oldest on the left,
+ * 1 pixel per half millisecond with a line at one frame (16.7 ms)
+ */
+void
+draw_timing_overlay()
+{
+        static const uint8_t phase_colors[TIMING_PHASES - 1][3] = {
+                {0xE0, 0x40, 0x40},     // CPU
+                {0x40, 0xC0, 0x40},     // PPU
+                {0x40, 0x60, 0xE0},     // Present
+                {0x90, 0x90, 0x90},     // Sleep
+        };
+        SDL_Rect bars[TIMING_PHASES - 1][TIMING_HISTORY];
+        for (int x = 0; x < TIMING_HISTORY; x++) {
+                uint32_t *frame = timing_recent[(timing_recent_pos + x) % TIMING_HISTORY];
+                int y = 144;
+                for (int phase = 0; phase < TIMING_PHASES - 1; phase++) {
+                        int height = MIN(frame[phase] / 500, (uint32_t) y);
+                        y -= height;
+                        bars[phase][x] = (SDL_Rect) {x, y, 1, height};
+                }
+        }
+
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+        for (int phase = 0; phase < TIMING_PHASES - 1; phase++) {
+                SDL_SetRenderDrawColor(renderer, phase_colors[phase][0], phase_colors[phase][1],
+                                       phase_colors[phase][2], 0xC0);
+                SDL_RenderFillRects(renderer, bars[phase], TIMING_HISTORY);
+        }
+        SDL_Rect budget = {0, 144 - 33, 160, 1};
+        SDL_SetRenderDrawColor(renderer, 0xFF, 0xD0, 0x00, 0xFF);
+        SDL_RenderFillRect(renderer, &budget);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+}
\ No newline at end of file
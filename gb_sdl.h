@@ -0,0 +1,13 @@
+#include <unistd.h>
+
+/*
+ * Shared variables
+ */
+extern bool timing_overlay;     // Frame time graph over the screen
+
+/*
+ * Function headers
+ */
+int init_SDL();
+void update_SDL();
+void draw_timing_overlay();
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_gpu.h"
+#include "gb_apu.h"
+#include "gb_rom.h"
+#include "gb_state.h"
+
+/*
+ *      Save states
+ *
+ *      A state is a small header followed by every piece of machine state
+ *      copied verbatim, each region at a fixed offset padded to 8 bytes. There
+ *      is nothing to parse, so loading from a buffer (or an mmapped file) is a
+ *      header check and one memcpy per region. The header records the version
+ *      and total size, so a state from a build with a different layout is
+ *      rejected instead of misread. Bump STATE_VERSION when regions change.
+ *
+ *      The ROM itself is not saved, the same ROM has to be loaded first.
+ */
+
+struct state_header {
+        char magic[4];          // "GBST"
+        uint16_t version;
+        uint16_t regions;
+        uint32_t size;          // Whole state including this header
+        uint32_t rom_id;        // Cartridge header and global checksums
+};
+
+struct state_region {
+        void *data;
+        uint32_t size;
+};
+
+// Everything that makes up the machine, in file order
+struct state_region state_regions[] = {
+        {&reg, sizeof(reg)},
+        {&PC, sizeof(PC)},
+        {&SP, sizeof(SP)},
+        {&IME, sizeof(IME)},
+        {&IE, sizeof(IE)},
+        {&IF, sizeof(IF)},
+        {&HALT, sizeof(HALT)},
+        {&ei_delay, sizeof(ei_delay)},
+        {&halt_bug, sizeof(halt_bug)},
+        {&RAMG, sizeof(RAMG)},
+        {&RBANK1, sizeof(RBANK1)},
+        {&RBANK2, sizeof(RBANK2)},
+        {&RMODE, sizeof(RMODE)},
+        {&MBC3_cwrite, sizeof(MBC3_cwrite)},
+        {&eram_bank, sizeof(eram_bank)},
+        {&div_lower, sizeof(div_lower)},
+        {&tima_lower, sizeof(tima_lower)},
+        {&lcd_cycles, sizeof(lcd_cycles)},
+        {&dma_cycles, sizeof(dma_cycles)},
+        {&joystick_flags, sizeof(joystick_flags)},
+        {&opcodes_run, sizeof(opcodes_run)},
+        {&frames_run, sizeof(frames_run)},
+        {&cycles_run, sizeof(cycles_run)},
+        {&apu, sizeof(apu)},
+        {&apu_pending, sizeof(apu_pending)},
+        {IOR, sizeof(IOR)},
+        {HRAM, sizeof(HRAM)},
+        {OAM, sizeof(OAM)},
+        {ERAM, sizeof(ERAM)},
+        {VRAM, sizeof(VRAM)},
+        {WRAM, sizeof(WRAM)},
+        {graphics_raw, sizeof(graphics_raw)},
+};
+
+#define NUM_REGIONS (sizeof(state_regions) / sizeof(state_regions[0]))
+#define PADDED(size) (((size) + 7) & ~7u)
+
+/*
+ * Identifies the loaded cartridge, usable before init_cpu
+ */
+uint32_t
+rom_id()
+{
+        return (load_rom[0x14D] << 16) | (load_rom[0x14E] << 8) | load_rom[0x14F];
+}
+
+/*
+ * Zero everything a state holds, init_cpu sets the power on values after
+ */
+void
+clear_state()
+{
+        for (uint32_t i = 0; i < NUM_REGIONS; i++) {
+                memset(state_regions[i].data, 0, state_regions[i].size);
+        }
+}
+
+/*
+ * Size in bytes of a saved state
+ */
+uint32_t
+state_size()
+{
+        uint32_t size = PADDED(sizeof(struct state_header));
+        for (uint32_t i = 0; i < NUM_REGIONS; i++) {
+                size += PADDED(state_regions[i].size);
+        }
+        return size;
+}
+
+/*
+ * Save the machine into buf, which must hold state_size() bytes
+ */
+void
+save_state_mem(uint8_t *buf)
+{
+        struct state_header header;
+        memset(buf, 0, PADDED(sizeof(header)));
+        memcpy(header.magic, "GBST", 4);
+        header.version = STATE_VERSION;
+        header.regions = NUM_REGIONS;
+        header.size = state_size();
+        header.rom_id = rom_id();
+        memcpy(buf, &header, sizeof(header));
+
+        uint8_t *pos = buf + PADDED(sizeof(header));
+        for (uint32_t i = 0; i < NUM_REGIONS; i++) {
+                memcpy(pos, state_regions[i].data, state_regions[i].size);
+                // Padding is zeroed so identical machines give identical states
+                memset(pos + state_regions[i].size, 0, PADDED(state_regions[i].size) - state_regions[i].size);
+                pos += PADDED(state_regions[i].size);
+        }
+}
+
+/*
+ * Load the machine from a saved state, the buffer is read in place.
+ * Returns -1 (leaving the machine untouched) if the state doesn't fit
+ */
+int
+load_state_mem(const uint8_t *buf, uint32_t len)
+{
+        struct state_header header;
+        if (len < sizeof(header)) {
+                return -1;
+        }
+        memcpy(&header, buf, sizeof(header));
+        if (memcmp(header.magic, "GBST", 4) != 0 || header.version != STATE_VERSION ||
+            header.regions != NUM_REGIONS || header.size != state_size() || len < header.size) {
+                if (verbose) printf("Save state is from another version\n");
+                return -1;
+        }
+        if (header.rom_id != rom_id()) {
+                if (verbose) printf("Save state is for another ROM\n");
+                return -1;
+        }
+
+        const uint8_t *pos = buf + PADDED(sizeof(header));
+        for (uint32_t i = 0; i < NUM_REGIONS; i++) {
+                memcpy(state_regions[i].data, pos, state_regions[i].size);
+                pos += PADDED(state_regions[i].size);
+        }
+        update_memory_map();
+        update_interrupts();
+        return 0;
+}
+
+/*
+ * Save the machine to a file
+ */
+int
+save_state(char *filename)
+{
+        uint32_t size = state_size();
+        uint8_t *buf = malloc(size);
+        save_state_mem(buf);
+
+        FILE *state_file = fopen(filename, "wb");
+        if (state_file == NULL) {
+                free(buf);
+                return -1;
+        }
+        size_t written = fwrite(buf, size, 1, state_file);
+        fclose(state_file);
+        free(buf);
+        return written == 1 ? 0 : -1;
+}
+
+/*
+ * Load the machine from a file
+ */
+int
+load_state(char *filename)
+{
+        uint32_t size = state_size();
+        uint8_t *buf = malloc(size);
+
+        FILE *state_file = fopen(filename, "rb");
+        if (state_file == NULL) {
+                free(buf);
+                return -1;
+        }
+        size_t read = fread(buf, 1, size, state_file);
+        fclose(state_file);
+
+        int result = load_state_mem(buf, read);
+        free(buf);
+        return result;
+}
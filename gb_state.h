@@ -0,0 +1,17 @@
+#include <unistd.h>
+
+/*
+ *      Function headers
+ */
+uint32_t rom_id();
+void clear_state();
+uint32_t state_size();
+void save_state_mem(uint8_t *buf);
+int load_state_mem(const uint8_t *buf, uint32_t len);
+int save_state(char *filename);
+int load_state(char *filename);
+
+/*
+ *      Constants definitions
+ */
+#define STATE_VERSION 3         // 3: EI delay and HALT bug
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "gb_timing.h"
+
+/*
+ *      Frame timing
+ *
+ *      Each frontend frame is split into phases (CPU, PPU, present, sleep)
+ *      timed with the monotonic clock, and every phase goes into a log-linear
+ *      histogram: values below 16 ns get their own bucket, above that each
+ *      power of two is split into 16 buckets, so any percentile is within
+ *      about 6% while the table stays a fixed 5 KB. p50, p99 and max of each
+ *      phase are printed at exit, and the last TIMING_HISTORY frames are kept
+ *      for the overlay.
+ *
+ *      The PPU is timed per scanline from update_lcd, only while timing is on.
+ */
+
+bool timing_active = false;
+uint64_t timing_ppu_ns = 0;
+uint32_t timing_recent[TIMING_HISTORY][TIMING_PHASES];
+int timing_recent_pos = 0;
+
+struct histogram timing_histograms[TIMING_PHASES];
+long timing_late = 0;           // Frames over 1.5 frame times
+
+char *timing_names[TIMING_PHASES] = {"cpu", "ppu", "present", "sleep", "frame"};
+
+uint64_t
+timing_now()
+{
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static int
+bucket(uint64_t ns)
+{
+        if (ns < 16) {
+                return ns;
+        }
+        int exponent = 63 - __builtin_clzll(ns);
+        int index = (exponent - 3) * 16 + ((ns >> (exponent - 4)) & 15);
+        return MIN(index, TIMING_BUCKETS - 1);
+}
+
+// Middle of the values a bucket covers
+static uint64_t
+bucket_value(int index)
+{
+        if (index < 16) {
+                return index;
+        }
+        int exponent = index / 16 + 3;
+        uint64_t low = (uint64_t) (16 + index % 16) << (exponent - 4);
+        return low + ((1ull << (exponent - 4)) >> 1);
+}
+
+static void
+record(struct histogram *histogram, uint64_t ns)
+{
+        histogram->counts[bucket(ns)]++;
+        histogram->total++;
+        histogram->max = MAX(histogram->max, ns);
+}
+
+/*
+ * Value below which the given fraction (0 to 1) of samples fall
+ */
+uint64_t
+histogram_percentile(struct histogram *histogram, double percentile)
+{
+        uint64_t target = percentile * histogram->total;
+        uint64_t seen = 0;
+        for (int i = 0; i < TIMING_BUCKETS; i++) {
+                seen += histogram->counts[i];
+                if (seen > target) {
+                        return MIN(bucket_value(i), histogram->max);
+                }
+        }
+        return histogram->max;
+}
+
+/*
+ * Record a finished frame, phase_ns holds each phase's time. The PPU time is
+ * taken from timing_ppu_ns (and cleared) and is not counted as CPU time
+ */
+void
+timing_frame(uint64_t *phase_ns)
+{
+        phase_ns[TIMING_PPU] = timing_ppu_ns;
+        phase_ns[TIMING_CPU] -= MIN(timing_ppu_ns, phase_ns[TIMING_CPU]);
+        timing_ppu_ns = 0;
+
+        for (int phase = 0; phase < TIMING_PHASES; phase++) {
+                record(&timing_histograms[phase], phase_ns[phase]);
+                timing_recent[timing_recent_pos][phase] = MIN(phase_ns[phase] / 1000, UINT32_MAX);
+        }
+        timing_recent_pos = (timing_recent_pos + 1) % TIMING_HISTORY;
+
+        // 59.73 frames a second, half a frame over is a visible stutter
+        if (phase_ns[TIMING_FRAME] > 25000000) {
+                timing_late++;
+        }
+}
+
+void
+print_timing(FILE *out)
+{
+        uint64_t frames = timing_histograms[TIMING_FRAME].total;
+        if (!frames) {
+                return;
+        }
+        fprintf(out, "Frame timing over %lu frames (ms)     p50      p99      max\n", (unsigned long) frames);
+        for (int phase = 0; phase < TIMING_PHASES; phase++) {
+                struct histogram *histogram = &timing_histograms[phase];
+                fprintf(out, "  %-34s %8.3f %8.3f %8.3f\n", timing_names[phase],
+                        histogram_percentile(histogram, 0.5) / 1e6,
+                        histogram_percentile(histogram, 0.99) / 1e6, histogram->max / 1e6);
+        }
+        fprintf(out, "  late frames (over 25 ms): %ld\n", timing_late);
+}
@@ -0,0 +1,36 @@
+#include <unistd.h>
+
+/*
+ *      Frame phases
+ */
+#define TIMING_CPU 0            // run_frame, less the PPU
+#define TIMING_PPU 1            // drawline_lcd
+#define TIMING_PRESENT 2        // update_SDL
+#define TIMING_SLEEP 3          // align_framerate
+#define TIMING_FRAME 4          // Whole loop iteration
+#define TIMING_PHASES 5
+
+#define TIMING_BUCKETS 640      // 16 per power of two, up to 2^40 ns
+#define TIMING_HISTORY 160      // Recent frames kept for the overlay
+
+struct histogram {
+        uint64_t counts[TIMING_BUCKETS];
+        uint64_t total;
+        uint64_t max;
+};
+
+/*
+ *      Shared variables
+ */
+extern bool timing_active;
+extern uint64_t timing_ppu_ns;          // PPU time so far this frame
+extern uint32_t timing_recent[TIMING_HISTORY][TIMING_PHASES];  // Microseconds
+extern int timing_recent_pos;           // Next slot of timing_recent
+
+/*
+ *      Function headers
+ */
+uint64_t timing_now();
+void timing_frame(uint64_t *phase_ns);
+uint64_t histogram_percentile(struct histogram *histogram, double percentile);
+void print_timing(FILE *out);
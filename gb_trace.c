@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_trace.h"
+
+/*
+ *      Instruction trace
+ *
+ *      Writes a binary record per instruction: the registers and cycle count
+ *      after it, then every write_mem it made. Two builds tracing the same ROM
+ *      must produce identical streams, which tracediff checks in lockstep.
+ *      Records are in host byte order, as both sides run on one machine.
+ */
+
+FILE *trace_file;
+bool trace_active = false;
+
+struct trace_record trace_current;
+struct trace_write trace_writes[TRACE_MAX_WRITES];
+
+/*
+ * Open the trace output, "-" for stdout (messages then go to stderr)
+ */
+int
+init_trace(char *target)
+{
+        if (strcmp(target, "-") == 0) {
+                fflush(stdout);
+                trace_file = fdopen(dup(STDOUT_FILENO), "wb");
+                dup2(STDERR_FILENO, STDOUT_FILENO);
+        }
+        else {
+                trace_file = fopen(target, "wb");
+        }
+        if (trace_file == NULL) {
+                printf("Error opening trace output %s\n", target);
+                return -1;
+        }
+        setvbuf(trace_file, NULL, _IOFBF, 1 << 20);
+        memset(&trace_current, 0, sizeof(trace_current));
+        memset(trace_writes, 0, sizeof(trace_writes));
+        trace_active = true;
+        return 0;
+}
+
+/*
+ * Called by write_mem while tracing
+ */
+void
+trace_write(uint16_t addr, uint8_t val)
+{
+        if (trace_current.writes < TRACE_MAX_WRITES) {
+                trace_writes[trace_current.writes].addr = addr;
+                trace_writes[trace_current.writes].val = val;
+                trace_current.writes++;
+        }
+}
+
+/*
+ * Record the instruction just run, and start collecting the next one's writes
+ */
+static int
+trace_step()
+{
+        trace_current.cycles = cycles_run;
+        trace_current.frame = frames_run;
+        trace_current.pc = PC;
+        trace_current.sp = SP;
+        trace_current.af = reg.af;
+        trace_current.bc = reg.bc;
+        trace_current.de = reg.de;
+        trace_current.hl = reg.hl;
+        trace_current.ime = IME;
+        fwrite(&trace_current, sizeof(trace_current), 1, trace_file);
+        if (fwrite(trace_writes, sizeof(struct trace_write), trace_current.writes, trace_file)
+            != trace_current.writes) {
+                return -1;
+        }
+        trace_current.writes = 0;
+        return 0;
+}
+
+/*
+ * Run like run_frame, tracing each instruction. Returns -1 if the output
+ * fails (the reader has gone)
+ */
+int
+trace_run_frame()
+{
+        trace_current.writes = 0;
+        if (run_frame_with(trace_step) == -1) {
+                return -1;
+        }
+        return ferror(trace_file) ? -1 : 0;
+}
+
+void
+close_trace()
+{
+        if (trace_active) {
+                fclose(trace_file);
+                trace_active = false;
+        }
+}
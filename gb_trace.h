@@ -0,0 +1,43 @@
+#include <unistd.h>
+
+/*
+ *      Trace records, one per instruction followed by its memory writes
+ */
+struct trace_record {
+        uint64_t cycles;        // After the instruction
+        uint32_t frame;
+        uint16_t pc;            // Registers after the instruction
+        uint16_t sp;
+        uint16_t af;
+        uint16_t bc;
+        uint16_t de;
+        uint16_t hl;
+        uint8_t ime;
+        uint8_t writes;         // Number of trace_write entries following
+};
+
+struct trace_write {
+        uint16_t addr;
+        uint8_t val;
+        uint8_t pad;
+};
+
+/*
+ *      Hook for write_mem, a flag test while not tracing
+ */
+extern bool trace_active;
+
+#define TRACE_WRITE(addr, val) do { if (trace_active) trace_write((addr), (val)); } while (0)
+
+/*
+ *      Function headers
+ */
+int init_trace(char *target);
+void trace_write(uint16_t addr, uint8_t val);
+int trace_run_frame();
+void close_trace();
+
+/*
+ *      Constants definitions
+ */
+#define TRACE_MAX_WRITES 255    // Per instruction, more are dropped
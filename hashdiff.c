@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+/*
+ *      Hash log comparison
+ *
+ *      Reads two logs written with -H and reports the first frame where they
+ *      differ, in the frame hash or (for -W logs) the state hash. Exits with 0
+ *      when they match, 1 when they diverge and 2 on bad input.
+ */
+
+struct hash_line {
+        long frame;
+        uint64_t frame_hash;
+        uint64_t state_hash;
+        int fields;             // 2 without a state hash, 3 with one, 0 at the end
+};
+
+/*
+ * Read the next line of a log
+ */
+int
+read_line(FILE *log, struct hash_line *line)
+{
+        char text[128];
+        if (fgets(text, sizeof(text), log) == NULL) {
+                line->fields = 0;
+                return 0;
+        }
+        line->state_hash = 0;
+        line->fields = sscanf(text, "%ld %" SCNx64 " %" SCNx64, &line->frame, &line->frame_hash, &line->state_hash);
+        return line->fields >= 2 ? 0 : -1;
+}
+
+int
+main(int argc, char **argv)
+{
+        if (argc != 3) {
+                fprintf(stderr, "Usage: hashdiff <log a> <log b>\n");
+                return 2;
+        }
+        FILE *a = fopen(argv[1], "r");
+        FILE *b = fopen(argv[2], "r");
+        if (a == NULL || b == NULL) {
+                fprintf(stderr, "Error opening %s\n", a == NULL ? argv[1] : argv[2]);
+                return 2;
+        }
+
+        long lines = 0;
+        struct hash_line line_a, line_b;
+        while (true) {
+                if (read_line(a, &line_a) == -1 || read_line(b, &line_b) == -1) {
+                        fprintf(stderr, "Bad line %ld\n", lines + 1);
+                        return 2;
+                }
+                if (!line_a.fields || !line_b.fields) {
+                        break;
+                }
+                lines++;
+                if (line_a.frame != line_b.frame) {
+                        printf("Frame numbers differ at line %ld: %ld and %ld\n", lines, line_a.frame, line_b.frame);
+                        return 1;
+                }
+                if (line_a.frame_hash != line_b.frame_hash) {
+                        printf("Frames diverge at frame %ld: %016" PRIx64 " and %016" PRIx64 "\n",
+                               line_a.frame, line_a.frame_hash, line_b.frame_hash);
+                        return 1;
+                }
+                if (line_a.fields == 3 && line_b.fields == 3 && line_a.state_hash != line_b.state_hash) {
+                        printf("State diverges at frame %ld (frames still match): %016" PRIx64 " and %016" PRIx64 "\n",
+                               line_a.frame, line_a.state_hash, line_b.state_hash);
+                        return 1;
+                }
+        }
+
+        if (line_a.fields != line_b.fields) {
+                printf("%s ends after %ld frames, the other log goes on\n",
+                       line_a.fields ? argv[2] : argv[1], lines);
+                return 1;
+        }
+        printf("Logs match over %ld frames\n", lines);
+        return 0;
+}
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "gb_cpu.h"
+#include "gb_gpu.h"
+#include "gb_capture.h"
+#include "gb_rom.h"
+#include "gb_profile.h"
+#include "gb_sampler.h"
+#include "gb_gdb.h"
+#include "gb_movie.h"
+#include "gb_hash.h"
+#include "gb_trace.h"
+
+/*
+ *      Headless runner
+ *
+ *      Runs a ROM unthrottled with no window or sound for a number of frames,
+ *      then prints the frame count, cycles run and final frame hash. Frames
+ *      can be captured the same way as in the SDL frontend. With -D it waits
+ *      for a GDB remote protocol debugger on a local port first, and runs
+ *      under its control. Input movies from the frontend replay with every
+ *      frame hash checked (recorded here, they hold only the hashes).
+ */
+
+bool boot_flag = true;
+long frame_limit = 600;
+char *capture_target = NULL;
+int capture_format = CAPTURE_RAW;
+char *profile_filename = NULL;
+char *samples_filename = NULL;
+int gdb_port = 0;
+char *record_filename = NULL;
+char *movie_filename = NULL;
+bool frames_given = false;
+char *hashlog_filename = NULL;
+bool hashlog_with_state = false;
+char *trace_target = NULL;
+
+void
+usage()
+{
+    fprintf(stderr, "Usage: headless [-bhv] [-n frames] [-c output] [-f format] [-P profile] [-g samples] [-m movie] [-M movie] [-H log [-W]] [-T trace] [-D port] <filename>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Skip boot rom.\n");
+    fprintf(stderr, "\t-v         Print basic debug messages.\n");
+    fprintf(stderr, "\t-n frames  Frames to run (default 600, the whole movie, or unlimited with -D).\n");
+    fprintf(stderr, "\t-c output  Capture frames to a file, - for stdout or |command.\n");
+    fprintf(stderr, "\t-f format  Capture format: raw, rgb or y4m.\n");
+    fprintf(stderr, "\t-P file    Save opcode and memory counters (.csv or .json).\n");
+    fprintf(stderr, "\t-g file    Sample guest call stacks, saved as folded stacks.\n");
+    fprintf(stderr, "\t-m file    Record keys and frame hashes to an input movie.\n");
+    fprintf(stderr, "\t-M file    Replay an input movie, failing at the first frame that differs.\n");
+    fprintf(stderr, "\t-H file    Log frame hashes at every VBlank, for hashdiff.\n");
+    fprintf(stderr, "\t-W         Also log a hash of the registers, WRAM and HRAM.\n");
+    fprintf(stderr, "\t-T output  Trace every instruction and memory write (binary), - for stdout.\n");
+    fprintf(stderr, "\t-D port    Wait for a GDB remote debugger on this local port.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+int
+main(int argc, char **argv)
+{
+        int c;
+        while ((c = getopt(argc, argv, "bvn:c:f:P:g:m:M:H:WT:D:h")) != -1) {
+                switch (c)
+                {
+                case 'b':       // Skipping boot rom
+                        boot_flag = false;
+                        break;
+                case 'v':       // Verbose flags
+                        verbose = 1;
+                        break;
+                case 'n':       // Frame count
+                        frame_limit = atol(optarg);
+                        frames_given = true;
+                        break;
+                case 'c':       // Capture output
+                        capture_target = optarg;
+                        break;
+                case 'f':       // Capture format
+                        capture_format = parse_capture_format(optarg);
+                        if (capture_format == -1) {
+                                usage();
+                                return -1;
+                        }
+                        break;
+                case 'P':       // Profile output
+                        profile_filename = optarg;
+                        break;
+                case 'g':       // Sampling profiler output
+                        samples_filename = optarg;
+                        break;
+                case 'm':       // Movie recording
+                        record_filename = optarg;
+                        break;
+                case 'M':       // Movie playback
+                        movie_filename = optarg;
+                        break;
+                case 'H':       // Hash log
+                        hashlog_filename = optarg;
+                        break;
+                case 'W':       // Hash log with state
+                        hashlog_with_state = true;
+                        break;
+                case 'T':       // Instruction trace
+                        trace_target = optarg;
+                        break;
+                case 'D':       // Remote debugger port
+                        gdb_port = atoi(optarg);
+                        break;
+                default:
+                        usage();
+                        return -1;
+                }
+        }
+        if (optind == argc) {
+                usage();
+                return -1;
+        }
+
+        // The trace may take over stdout, so it starts before anything is printed
+        if (trace_target && init_trace(trace_target) == -1) {
+                return -1;
+        }
+
+        // A movie sets the boot flag itself and was recorded on this ROM
+        if (read_rom(argv[optind], boot_flag && !movie_filename) == -1) {
+                printf("Error reading ROM\n");
+                return -1;
+        }
+        if (movie_filename) {
+                if (play_movie(movie_filename) == -1) {
+                        return -1;
+                }
+                boot_flag = movie_boot();
+                if (!frames_given) {
+                        frame_limit = movie_length();
+                }
+        }
+        else if (record_filename && record_movie(record_filename, boot_flag) == -1) {
+                return -1;
+        }
+        init_cpu(load_rom, NULL, num_banks, cartridge_type, boot_flag);
+        init_gpu();
+        if (samples_filename && init_sampler(SAMPLER_PERIOD, find_symbols(argv[optind])) == -1) {
+                return -1;
+        }
+        if (capture_target && init_capture(capture_target, capture_format) == -1) {
+                return -1;
+        }
+
+        if (hashlog_filename && init_hashlog(hashlog_filename, hashlog_with_state) == -1) {
+                return -1;
+        }
+        if (gdb_port && init_gdb(gdb_port) == -1) {
+                return -1;
+        }
+        // A debugged run lasts as long as the debugger stays attached
+        if (gdb_port && !frames_given) {
+                frame_limit = LONG_MAX;
+        }
+
+        int status = 0;
+        for (long frame = 0; frame < frame_limit; frame++) {
+                if (gdb_port && !frames_given && !gdb_active) {
+                        break;
+                }
+                movie_input();
+                if (gdb_active) {
+                        int result = gdb_frame();
+                        if (result == -1) {
+                                break;
+                        }
+                        if (result == 0) {      // Stopped partway, same frame again
+                                frame--;
+                                continue;
+                        }
+                }
+                else if (trace_active) {
+                        if (trace_run_frame() == -1) {
+                                break;
+                        }
+                }
+                else {
+                        run_frame();
+                }
+                if (movie_frame() == -1) {
+                        status = 1;
+                        break;
+                }
+                if (capture_frame() == -1) {
+                        status = 1;
+                        break;
+                }
+        }
+        close_gdb();
+        close_movie();
+        close_hashlog();
+        close_trace();
+        if (close_capture() == -1) {
+                status = 1;
+        }
+        if (profile_filename && save_profile(profile_filename) == -1) {
+                return -1;
+        }
+        if (samples_filename && save_samples(samples_filename) == -1) {
+                return -1;
+        }
+
+        // Keep stdout clean when it carries the capture or trace
+        FILE *out = (capture_target && capture_target[0] == '-') ||
+                    (trace_target && trace_target[0] == '-') ? stderr : stdout;
+        fprintf(out, "frames %ld cycles %" PRIu64 " hash %016" PRIx64 "\n",
+                get_frames(), get_cycles(), hash_frame());
+        return status;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <SDL.h>
 #include <SDL_audio.h>
 #include <math.h>
@@ -8,33 +9,72 @@
 #include "main.h"
 #include "gb_cpu.h"
 #include "gb_gpu.h"
+#include "gb_capture.h"
+#include "gb_apu.h"
+#include "gb_rom.h"
+#include "gb_state.h"
+#include "gb_rewind.h"
+#include "gb_sdl.h"
+#include "gb_profile.h"
+#include "gb_sampler.h"
+#include "gb_timing.h"
+#include "gb_debug.h"
+#include "gb_movie.h"
+#include "gb_hash.h"
 
 // Verbosity
-int verbose = 0;
 int debug = 0;
 int start = 1;
 FILE *output;
 
-// Rom reading
-uint8_t *load_rom;           // ROM from cartridge
-uint8_t *load_save;             // Save file
-bool has_save = false;                 // Whether to load a save file
-int cartridge_type; // Cartridge banking type
-char *cartridge_types[] = {"ROM ONLY", "MBC1", "MBC2", "MBC3"};
-// Saving read rom/ram sizes
-uint32_t rom_size;
-uint32_t ram_size;
-int num_banks;              // Number of rom banks
-
-// I/O other
-uint8_t joystick_flags = 0xFF; // Joystick bits for reading 0xFF00
-
 // If emulator is active
 bool active = true;
 
 // Whether to run boot rom
 bool boot_flag = true;
 
+// Run as fast as possible instead of at 60 fps
+bool unthrottled = false;
+
+// Stop after this many frames (0 runs until quit)
+long frame_limit = 0;
+
+// Frame capture output
+char *capture_target = NULL;
+int capture_format = CAPTURE_RAW;
+
+// Execution profile output (needs a -DGB_PROFILE build)
+char *profile_filename = NULL;
+
+// Guest sampling profile output, folded stacks
+char *samples_filename = NULL;
+
+// Print frame timing histograms at exit
+bool print_timings = false;
+
+// Input movie to record or play back
+char *record_filename = NULL;
+char *movie_filename = NULL;
+
+// Hash log, optionally with registers and memory
+char *hashlog_filename = NULL;
+bool hashlog_with_state = false;
+
+// Save state file, the rom name with .state appended
+char state_filename[512];
+
+// Rewind history, snapshot every this many frames (0 disables)
+long snapshot_interval = 1;
+bool rewinding = false;         // Backspace held
+
+// Audio output
+SDL_AudioDeviceID audio_device = 0;
+
+// Pace emulation by the audio device clock instead of SDL_GetTicks
+bool audio_pacing = false;
+SDL_mutex *audio_lock;
+SDL_cond *audio_drained;        // Signalled when the device takes samples
+
 // Framerate syncing
 long last_tick;
 long current_tick;
@@ -44,12 +84,50 @@ long catchup_ticks = 0;
 uint16_t curr_cycles;           // Cycle count of curent cpu operation
 long total_cycles = 0;
 
+/*
+ * Run until a breakpoint or watchpoint is hit (or Esc is pressed or the
+ * window closed), showing frames along the way. Returns the debug_run_frame
+ * result
+ */
+static int
+debug_continue()
+{
+        SDL_Event event;
+        int hit = 0;
+        while (!hit) {
+                hit = debug_run_frame();
+                if (!hit) {
+                        update_SDL();
+                }
+                while (SDL_PollEvent(&event)) {
+                        if (event.type == SDL_QUIT) {
+                                active = false;
+                                return 0;
+                        }
+                        if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE) {
+                                printf("Stopped at %04X\n", get_PC());
+                                return 0;
+                        }
+                }
+        }
+        if (hit == DEBUG_BREAK) {
+                printf("Breakpoint at %04X\n", debug_hit_addr());
+        }
+        else {
+                printf("Watchpoint %s %04X, PC %04X\n", hit == DEBUG_READ ? "read" : "write",
+                       debug_hit_addr(), get_PC());
+        }
+        print_registers();
+        return hit;
+}
+
 int
 main(int argc, char **argv)
 {
         // Checking for verbose flag
         char c;
-        while ((c = getopt (argc, argv, "bvdsVl")) != -1) {
+        char *options = "bvdsVlc:f:un:ar:P:g:tm:M:H:W";
+        while ((c = getopt (argc, argv, options)) != -1) {
                 switch (c)
                 {
                 case 'v':       // Verbose flags
@@ -75,20 +153,72 @@ main(int argc, char **argv)
                         }
                         */
                         break;
+                case 'c':       // Capture frames to file or pipe
+                        capture_target = optarg;
+                        break;
+                case 'f':       // Capture format
+                        capture_format = parse_capture_format(optarg);
+                        if (capture_format == -1) {
+                                fprintf(stderr, "Unknown capture format %s\n", optarg);
+                                return -1;
+                        }
+                        break;
+                case 'u':       // No framerate alignment
+                        unthrottled = true;
+                        break;
+                case 'a':       // Audio driven pacing
+                        audio_pacing = true;
+                        break;
+                case 'r':       // Rewind snapshot interval
+                        snapshot_interval = atol(optarg);
+                        break;
+                case 'P':       // Profile output
+                        profile_filename = optarg;
+                        break;
+                case 'g':       // Sampling profiler output
+                        samples_filename = optarg;
+                        break;
+                case 't':       // Frame timing
+                        print_timings = true;
+                        timing_active = true;
+                        break;
+                case 'n':       // Frame limit
+                        frame_limit = atol(optarg);
+                        break;
+                case 'm':       // Movie recording
+                        record_filename = optarg;
+                        break;
+                case 'M':       // Movie playback
+                        movie_filename = optarg;
+                        break;
+                case 'H':       // Hash log
+                        hashlog_filename = optarg;
+                        break;
+                case 'W':       // Hash log with state
+                        hashlog_with_state = true;
+                        break;
                 case 'h':
                         usage();
                         break;
-                case '?':
-                        if (optopt == 's')
+                case '?': {
+                        // Options followed by ':' in the list take an argument
+                        char *option = optopt && optopt != ':' ? strchr(options, optopt) : NULL;
+                        if (option && option[1] == ':')
                         fprintf (stderr, "Option -%c requires an argument.\n", optopt);
                         else
                         usage();
                         return -1;
+                }
                 default:
                         abort ();
                 }
         }
         
+        // Capture has to start before anything is printed to stdout
+        if (capture_target != NULL && init_capture(capture_target, capture_format) == -1) {
+                return -1;
+        }
+
         // Reading rom file
 	if (optind == argc) {         // Checking input arguments
 		printf("Missing file name");
@@ -110,11 +240,25 @@ main(int argc, char **argv)
         printf("\n");
 
 
-        if (read_rom(filename) == -1) {
+        // A movie sets the boot flag itself and was recorded on this ROM
+        if (read_rom(filename, boot_flag && !movie_filename) == -1) {
                 printf("Error reading ROM\n");
                 return -1;
         }
 
+        snprintf(state_filename, sizeof(state_filename), "%s.state", filename);
+
+        // Movies start from power on, with the boot rom if they were recorded with it
+        if (movie_filename) {
+                if (play_movie(movie_filename) == -1) {
+                        return -1;
+                }
+                boot_flag = movie_boot();
+        }
+        else if (record_filename && record_movie(record_filename, boot_flag) == -1) {
+                return -1;
+        }
+
         // Initialize Memory
         init_cpu(load_rom, load_save, num_banks, cartridge_type, boot_flag);
         init_gpu();
@@ -124,6 +268,22 @@ main(int argc, char **argv)
                 printf("Error initializing SDL\n");
                 return -1;
         }
+        // Sound is optional
+        if (init_audio() == -1) {
+                if (verbose || audio_pacing) {
+                        printf("Error opening audio device, running without sound\n");
+                }
+                audio_pacing = false;
+        }
+        if (samples_filename && init_sampler(SAMPLER_PERIOD, find_symbols(filename)) == -1) {
+                return -1;
+        }
+        if (hashlog_filename && init_hashlog(hashlog_filename, hashlog_with_state) == -1) {
+                return -1;
+        }
+        if (snapshot_interval > 0 && init_rewind(snapshot_interval, REWIND_BUFFER_SIZE) == -1) {
+                return -1;
+        }
         SDL_Event event;
         
         // First frame
@@ -141,6 +301,9 @@ main(int argc, char **argv)
                 // Get SDL events
                 while(SDL_PollEvent( &event ) ){
                         switch( event.type ){
+                                case SDL_QUIT:  // Closing window
+                                active = false;
+                                break;
                                 case SDL_KEYDOWN:
                                 switch (event.key.keysym.sym){
                                         case SDLK_ESCAPE:
@@ -204,12 +367,34 @@ main(int argc, char **argv)
                                                 int addr;
                                                 printf("Enter desired PC point: ");
                                                 scanf("%X", &addr);
-                                                verbose = 0;
-                                                while (get_PC() != addr) {
-                                                        execute_frame();
+                                                bool was_set = get_breakpoint(addr);
+                                                set_breakpoint(addr, true);
+                                                if (debug_continue() == DEBUG_BREAK && get_PC() == addr) {
+                                                        printf("Reached desired position\n");
                                                 }
-                                                verbose = 2;
-                                                printf("Reached desired position\n");
+                                                set_breakpoint(addr, was_set);
+                                        break;
+                                        case SDLK_b:    // Toggle a breakpoint
+                                                int break_addr;
+                                                printf("Enter breakpoint address: ");
+                                                scanf("%X", &break_addr);
+                                                set_breakpoint(break_addr, !get_breakpoint(break_addr));
+                                                printf("Breakpoint at %04X %s\n", break_addr,
+                                                       get_breakpoint(break_addr) ? "set" : "cleared");
+                                        break;
+                                        case SDLK_m:    // Toggle a memory watchpoint
+                                                int watch_addr;
+                                                char watch_type[4];
+                                                bool watch_on;
+                                                printf("Enter watch address and r, w or rw (- to clear): ");
+                                                scanf("%X %3s", &watch_addr, watch_type);
+                                                watch_on = watch_type[0] != '-';
+                                                set_watchpoint(watch_addr, (strchr(watch_type, 'r') ? DEBUG_READ : 0) |
+                                                               (strchr(watch_type, 'w') ? DEBUG_WRITE : 0) |
+                                                               (watch_on ? 0 : DEBUG_READ | DEBUG_WRITE), watch_on);
+                                        break;
+                                        case SDLK_r:    // Run to the next breakpoint or watchpoint
+                                                debug_continue();
                                         break;
                                 }
                         }
@@ -219,7 +404,10 @@ main(int argc, char **argv)
         
         // Normal setup
         else {
+        uint64_t phase_ns[TIMING_PHASES];
         while (active) {
+                uint64_t frame_start = timing_now();
+
                 // Get SDL events
                 while(SDL_PollEvent( &event ) ){
                         switch( event.type ){
@@ -231,6 +419,31 @@ main(int argc, char **argv)
                                         case SDLK_ESCAPE:
                                         active = false;
                                         break;
+                                        case SDLK_F5:   // Save state
+                                        if (save_state(state_filename) == -1) {
+                                                printf("Error saving state to %s\n", state_filename);
+                                        }
+                                        break;
+                                        case SDLK_F8:   // Load state, not while a movie runs
+                                        if (movie_active) {
+                                                printf("States can't be loaded during a movie\n");
+                                        }
+                                        else if (load_state(state_filename) == -1) {
+                                                printf("Error loading state from %s\n", state_filename);
+                                        }
+                                        break;
+                                        case SDLK_BACKSPACE:
+                                        rewinding = !movie_active;
+                                        break;
+                                        case SDLK_F3:   // Timing overlay
+                                        timing_overlay = !timing_overlay;
+                                        timing_active |= timing_overlay;
+                                        break;
+                                        case SDLK_F2:   // Save the profile so far
+                                        if (profile_filename) {
+                                                save_profile(profile_filename);
+                                        }
+                                        break;
                                         case SDLK_RIGHT:
                                         key_press(0x1);
                                         break;
@@ -286,173 +499,117 @@ main(int argc, char **argv)
                                         case SDLK_p:
                                         print_registers();
                                         break;
+                                        case SDLK_BACKSPACE:
+                                        rewinding = false;
+                                        break;
                                 
                                 }
                                 break;
                         }
                 }
-                // Framerate alignment done via cpu.c and align_framerate
+                // Step back one snapshot a frame while rewinding
+                if (rewinding) {
+                        rewind_state(1);
+                }
+                // CPU emulation up to the next VBlank
+                else {
+                        movie_input();
+                        run_frame();
+                        movie_frame();
+                        rewind_snapshot();
+                }
+                uint64_t cpu_end = timing_now();
 
-                // CPU emulation
-                curr_cycles = execute();
+                // Rendering
+                update_SDL();
+                capture_frame();
+                uint64_t present_end = timing_now();
 
-                // Timer updates
-                update_lcd(curr_cycles);
+                // Framerate alignment
+                if (!unthrottled) {
+                        align_framerate();
+                }
 
-                // Rendering
-                update_timers(curr_cycles);
+                if (timing_active) {
+                        uint64_t frame_end = timing_now();
+                        phase_ns[TIMING_CPU] = cpu_end - frame_start;
+                        phase_ns[TIMING_PRESENT] = present_end - cpu_end;
+                        phase_ns[TIMING_SLEEP] = frame_end - present_end;
+                        phase_ns[TIMING_FRAME] = frame_end - frame_start;
+                        timing_frame(phase_ns);
+                }
 
+                if (frame_limit && get_frames() >= frame_limit) {
+                        active = false;
+                }
         }
         }
-        if (verbose) {
-                printf("Exiting program\n");
+        close_capture();
+        close_movie();
+        close_hashlog();
+        close_rewind();
+        if (print_timings) {
+                print_timing(stdout);
         }
-        return 1;
-}
-
-/*
- *   Read the provided ROM and parse out the cartridge header data.
- */
-int
-read_rom(char *filename)
-{
-        FILE *rom_file = fopen(filename, "rb");
-
-        // Output error if file missing
-        if (rom_file == NULL) {
-                printf("Error opening provided filename\n");
-                return -1;
+        if (profile_filename) {
+                save_profile(profile_filename);
         }
-
-        // Copying into memory
-        fseek(rom_file, 0, SEEK_END);
-        long fsize = ftell(rom_file);
-        fseek(rom_file, 0, SEEK_SET); 
-        load_rom = (uint8_t*)malloc(fsize);
-        fread(load_rom, fsize, 1, rom_file);
-        fclose(rom_file);
-
-        // ROM Cartridge Type
-        switch (load_rom[0x147]) {
-                case 0:
-                cartridge_type = 0;
-                break;
-                case 1:
-                case 2:
-                case 3:
-                cartridge_type = 1;
-                break;
-                case 15:
-                case 16:
-                case 17:
-                case 18:
-                case 19:
-                cartridge_type = 3;
-                break;
-                default:
-                if (verbose) {
-                        printf("Unsupported ROM type\n");
-                }
-                return -1;
+        if (samples_filename) {
+                save_samples(samples_filename);
+                close_sampler();
+        }
+        if (audio_device) {
+                SDL_CloseAudioDevice(audio_device);
         }
         if (verbose) {
-                printf("The ROM has a %s cartridge type\n", cartridge_types[cartridge_type]);
-        }
-
-        // ROM Size
-        switch (load_rom[0x148]) {
-                case 0x0: rom_size = 0x8000; num_banks = 2; break;
-                case 0x1: rom_size = 0x10000; num_banks = 4; break;
-                case 0x2: rom_size = 0x20000; num_banks = 8; break;
-                case 0x3: rom_size = 0x40000; num_banks = 16; break;
-                case 0x4: rom_size = 0x80000; num_banks = 32; break;
-                case 0x5: rom_size = 0x100000; num_banks = 64; break;
-                case 0x6: rom_size = 0x200000; num_banks = 128; break;
-                case 0x7: rom_size = 0x400000; num_banks = 256; break;
-                case 0x8: rom_size = 0x800000; num_banks = 512; break;
-                case 0x52: rom_size = 0x120000; num_banks = 72; break;
-                case 0x53: rom_size = 0x140000; num_banks = 80; break;
-                case 0x54: rom_size = 0x160000; num_banks = 96; break;
-                default: if (verbose) printf("Error reading ROM size");
-        }
-
-        if (verbose) printf("The ROM has size %X\n", rom_size);
-
-        // RAM Size
-        switch (load_rom[0x149]) {
-                case 0x0: ram_size = 0; break;
-                case 0x1: ram_size = 0x800; break;
-                case 0x2: ram_size = 0x2000; break;
-                case 0x3: ram_size = 0x8000; break;
-                case 0x4: ram_size = 0x20000; break;
-                case 0x5: ram_size = 0x10000; break;
-                default: if (verbose) printf("Error reading RAM size");
-        }
-
-        if (verbose) printf("The RAM has size %X\n", ram_size);
-
-        // TODO: save files
-        if (has_save) {
-                // Get save name
-                char save_name[100];
-                sprintf(save_name, filename);
-                // Replace .gb with .sav
-                char *suffix = strstr(save_name, ".gb");
-                if (suffix == NULL) {
-                        printf("Error with filename");
-                        return -1;
-                }
-                sprintf(suffix, ".sav");
-                if (verbose) printf("Loading save at %s\n", save_name);
-                // Attempt to open file
-                FILE *save_file = fopen(save_name, "rb");
-                if (!save_file) {
-                        printf("Given save file does not exist\n");
-                        return -1;
-                }
-                // Copying into memory
-                load_save = (uint8_t*)malloc(ram_size);
-                fread(load_save, ram_size, 1, save_file);
-                fclose(save_file);
+                printf("Exiting program\n");
         }
-
-        // Returning without errors
-        return 0;
-
-}
-
-/*
- *      Getter and Setter functions
- */
-uint8_t
-get_joystick()
-{
-        return joystick_flags;
+        return 1;
 }
 
 /*
- * Updates joystick flags (set corresponding key to 0 in joystick flags)
+ *      Audio device callback, runs on SDL's audio thread
  */
 void
-key_press(uint8_t key)
+audio_callback(void *userdata, Uint8 *stream, int len)
 {
-        if (joystick_flags & key) {
-                update_joystick();
-                joystick_flags &= ~(key);
+        (void) userdata;
+        apu_read_samples((int16_t *) stream, len / 4);
+
+        // Wake the emulation thread if it is waiting for room
+        if (audio_pacing) {
+                SDL_LockMutex(audio_lock);
+                SDL_CondSignal(audio_drained);
+                SDL_UnlockMutex(audio_lock);
         }
-        update_joystick();
 }
 
-
 /*
- * Updates joystick flags (set corresponding key to 1 in joystick flags)
+ *      Open the audio device and start feeding it from the APU
  */
-void
-key_release(uint8_t key)
+int
+init_audio()
 {
-        joystick_flags |= key;
-        update_joystick();
+        SDL_AudioSpec want;
+        SDL_AudioSpec have;
+        memset(&want, 0, sizeof(want));
+        want.freq = 48000;
+        want.format = AUDIO_S16SYS;
+        want.channels = 2;
+        want.samples = 1024;
+        want.callback = audio_callback;
+
+        audio_lock = SDL_CreateMutex();
+        audio_drained = SDL_CreateCond();
+        audio_device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+        if (!audio_device) {
+                return -1;
+        }
+        apu_set_output(have.freq);
+        SDL_PauseAudioDevice(audio_device, 0);
+        return 0;
 }
+
 /*
  *      Wait between visual frames so that the timing is right
  *      Each frame should be 1.8 milliseconds
@@ -460,6 +617,28 @@ key_release(uint8_t key)
 void
 align_framerate()
 {
+        // The sound card consumes exactly 59.73 frames of samples a second,
+        // so block until it has drained what this frame produced. No samples
+        // are made while rewinding, so that falls back to the timer
+        if (audio_pacing && !rewinding) {
+                SDL_LockMutex(audio_lock);
+                while (apu_buffered() > AUDIO_TARGET_FILL) {
+                        // Don't hang if the device stops pulling samples
+                        if (SDL_CondWaitTimeout(audio_drained, audio_lock, 100) == SDL_MUTEX_TIMEDOUT) {
+                                break;
+                        }
+                }
+                SDL_UnlockMutex(audio_lock);
+                return;
+        }
+
+        // Steer the resampler so the audio buffer stays near its target,
+        // this absorbs the difference between our pacing and the sound card
+        if (audio_device) {
+                double fill = apu_buffered();
+                apu_set_rate_control(1.0 + 0.005 * (AUDIO_TARGET_FILL - fill) / AUDIO_TARGET_FILL);
+        }
+
         // Milliseconds
         current_tick = SDL_GetTicks();
         long frame_diff = current_tick - last_tick;
@@ -482,18 +661,22 @@ align_framerate()
 void
 execute_frame()
 {
+        long frame = get_frames();
         curr_cycles = execute();
         // Rendering
         update_lcd(curr_cycles);
         // Update timers
         update_timers(curr_cycles);
-
+        // Show the frame once it completes
+        if (get_frames() != frame) {
+                update_SDL();
+        }
 }
 
 void
 usage()
 {
-    fprintf(stderr, "Usage: main [-bhdvV] <filename>\n");
+    fprintf(stderr, "Usage: main [-bhdvVuat] [-n frames] [-r frames] [-P profile] [-g samples] [-m movie] [-M movie] [-H log [-W]] [-c output] [-f format] <filename>\n");
     fprintf(stderr, "Options\n");\
     fprintf(stderr, "\t-b         Skip boot rom.\n");
     fprintf(stderr, "\t-s         Load save from this file.\n");
@@ -502,4 +685,17 @@ usage()
     fprintf(stderr, "\t-v         Print basic debug messages.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
     fprintf(stderr, "\t-l         Log to the file Log.txt\n");
+    fprintf(stderr, "\t-u         Run unthrottled.\n");
+    fprintf(stderr, "\t-a         Pace emulation by the audio device clock.\n");
+    fprintf(stderr, "\t-n frames  Exit after this many frames.\n");
+    fprintf(stderr, "\t-r frames  Rewind snapshot interval, 0 disables (default 1).\n");
+    fprintf(stderr, "\t-P file    Save opcode and memory counters (.csv or .json) at exit or on F2.\n");
+    fprintf(stderr, "\t-g file    Sample guest call stacks, saved as folded stacks at exit.\n");
+    fprintf(stderr, "\t-t         Print frame timing percentiles at exit (F3 shows them live).\n");
+    fprintf(stderr, "\t-m file    Record an input movie (keys and frame hashes).\n");
+    fprintf(stderr, "\t-M file    Play back an input movie, checking every frame hash.\n");
+    fprintf(stderr, "\t-H file    Log frame hashes at every VBlank, for hashdiff.\n");
+    fprintf(stderr, "\t-W         Also log a hash of the registers, WRAM and HRAM.\n");
+    fprintf(stderr, "\t-c output  Capture frames to a file, - for stdout or |command.\n");
+    fprintf(stderr, "\t-f format  Capture format: raw, rgb or y4m.\n");
 }
\ No newline at end of file
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "gb_trace.h"
+
+/*
+ *      Differential execution
+ *
+ *      Runs two headless builds (a reference and one under test) on the same
+ *      ROM with -T -, and reads their instruction traces in lockstep. At the
+ *      first instruction where the registers, cycle count or memory writes
+ *      differ, prints both sides and the last instruction they agreed on.
+ *      Exits with 0 when the traces match, 1 at a divergence and 2 on errors.
+ */
+
+struct trace_step {
+        struct trace_record record;
+        struct trace_write writes[TRACE_MAX_WRITES];
+};
+
+/*
+ * Start a headless build writing its trace to a pipe, returns the read end
+ */
+FILE *
+start_trace(char *program, char **args, pid_t *pid)
+{
+        int fds[2];
+        if (pipe(fds) == -1) {
+                return NULL;
+        }
+        *pid = fork();
+        if (*pid == -1) {
+                return NULL;
+        }
+        if (*pid == 0) {
+                dup2(fds[1], STDOUT_FILENO);
+                close(fds[0]);
+                close(fds[1]);
+                args[0] = program;
+                execv(program, args);
+                fprintf(stderr, "Error running %s\n", program);
+                _exit(127);
+        }
+        close(fds[1]);
+        FILE *trace = fdopen(fds[0], "rb");
+        setvbuf(trace, NULL, _IOFBF, 1 << 20);
+        return trace;
+}
+
+/*
+ * Read the next instruction, returns false at the end of the trace
+ */
+bool
+read_step(FILE *trace, struct trace_step *step)
+{
+        if (fread(&step->record, sizeof(step->record), 1, trace) != 1) {
+                return false;
+        }
+        return fread(step->writes, sizeof(struct trace_write), step->record.writes, trace) ==
+               step->record.writes;
+}
+
+bool
+same_step(struct trace_step *a, struct trace_step *b)
+{
+        struct trace_record *ra = &a->record, *rb = &b->record;
+        if (ra->cycles != rb->cycles || ra->pc != rb->pc || ra->sp != rb->sp || ra->af != rb->af ||
+            ra->bc != rb->bc || ra->de != rb->de || ra->hl != rb->hl || ra->ime != rb->ime ||
+            ra->writes != rb->writes) {
+                return false;
+        }
+        for (int i = 0; i < ra->writes; i++) {
+                if (a->writes[i].addr != b->writes[i].addr || a->writes[i].val != b->writes[i].val) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+void
+print_step(const char *name, struct trace_step *step)
+{
+        struct trace_record *r = &step->record;
+        printf("%-10s frame %" PRIu32 " cycles %" PRIu64 " PC %04X SP %04X AF %04X BC %04X DE %04X HL %04X IME %d",
+               name, r->frame, r->cycles, r->pc, r->sp, r->af, r->bc, r->de, r->hl, r->ime);
+        for (int i = 0; i < r->writes; i++) {
+                printf(" [%04X]=%02X", step->writes[i].addr, step->writes[i].val);
+        }
+        printf("\n");
+}
+
+void
+usage()
+{
+    fprintf(stderr, "Usage: tracediff [-bh] [-n frames] <reference headless> <test headless> <rom>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Skip boot rom.\n");
+    fprintf(stderr, "\t-n frames  Frames to run (default 600).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+int
+main(int argc, char **argv)
+{
+        char *frames = "600";
+        bool boot_flag = true;
+        int c;
+        while ((c = getopt(argc, argv, "bn:h")) != -1) {
+                switch (c)
+                {
+                case 'b':       // Skipping boot rom
+                        boot_flag = false;
+                        break;
+                case 'n':       // Frame count
+                        frames = optarg;
+                        break;
+                default:
+                        usage();
+                        return 2;
+                }
+        }
+        if (argc - optind != 3) {
+                usage();
+                return 2;
+        }
+
+        // Both builds get the same arguments
+        char *args[8] = {NULL, "-T", "-", "-n", frames};
+        int num_args = 5;
+        if (!boot_flag) {
+                args[num_args++] = "-b";
+        }
+        args[num_args++] = argv[optind + 2];
+        args[num_args] = NULL;
+
+        pid_t reference_pid, test_pid;
+        FILE *reference = start_trace(argv[optind], args, &reference_pid);
+        FILE *test = start_trace(argv[optind + 1], args, &test_pid);
+        if (reference == NULL || test == NULL) {
+                fprintf(stderr, "Error starting traces\n");
+                return 2;
+        }
+
+        // The reference side alternates buffers, keeping the last match
+        static struct trace_step steps_ref[2], step_test;
+        int current = 0;
+        uint64_t instructions = 0;
+        int result = 0;
+        while (true) {
+                struct trace_step *step_ref = &steps_ref[current];
+                bool more_ref = read_step(reference, step_ref);
+                bool more_test = read_step(test, &step_test);
+                if (!more_ref || !more_test) {
+                        if (more_ref != more_test) {
+                                printf("%s trace ends after %" PRIu64 " instructions, the other goes on\n",
+                                       more_ref ? "Test" : "Reference", instructions);
+                                result = 1;
+                        }
+                        break;
+                }
+                if (!same_step(step_ref, &step_test)) {
+                        printf("Diverged at instruction %" PRIu64 "\n", instructions + 1);
+                        if (instructions) {
+                                print_step("last match", &steps_ref[current ^ 1]);
+                        }
+                        print_step("reference", step_ref);
+                        print_step("test", &step_test);
+                        result = 1;
+                        break;
+                }
+                current ^= 1;
+                instructions++;
+        }
+        if (result == 0) {
+                printf("Traces match over %" PRIu64 " instructions\n", instructions);
+        }
+
+        // Stop whichever side is still running
+        kill(reference_pid, SIGTERM);
+        kill(test_pid, SIGTERM);
+        fclose(reference);
+        fclose(test);
+        waitpid(reference_pid, NULL, 0);
+        waitpid(test_pid, NULL, 0);
+        return result;
+}
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ *      Training ROM generator
+ *
+ *      Writes a small 32 KB MBC1 test program to stdout, used as the workload
+ *      for profile guided builds (make pgo). It keeps the common paths of the
+ *      core busy: the LCD on with scrolling background and sprites, OAM DMA,
+ *      two sound channels retriggered every frame, VBlank interrupts with
+ *      HALT, CALL/PUSH/POP, ALU and CB ops over WRAM, ROM bank reads and
+ *      joypad polling. Building it from source keeps the training run
+ *      reproducible without shipping a binary.
+ */
+
+uint8_t rom[0x8000];
+int pc;
+
+// Emit bytes at pc
+void
+emit(int count, ...)
+{
+        __builtin_va_list args;
+        __builtin_va_start(args, count);
+        for (int i = 0; i < count; i++) {
+                rom[pc++] = __builtin_va_arg(args, int);
+        }
+        __builtin_va_end(args);
+}
+
+// Relative jump back to target
+void
+jr_back(int opcode, int target)
+{
+        rom[pc++] = opcode;
+        rom[pc] = (uint8_t) (target - (pc + 1));
+        pc++;
+}
+
+// LD A,value then LDH (reg),A
+void
+write_io(int reg, int value)
+{
+        emit(4, 0x3E, value, 0xE0, reg);
+}
+
+int
+main()
+{
+        int loop;
+
+        // VBlank handler, increments a counter in WRAM and scrolls by it
+        pc = 0x40;
+        emit(12, 0xF5, 0xFA, 0x00, 0xC0, 0x3C, 0xEA, 0x00, 0xC0, 0xE0, 0x43, 0xF1, 0xD9);
+
+        // Entry point and header
+        pc = 0x100;
+        emit(4, 0x00, 0xC3, 0x50, 0x01);
+        memcpy(rom + 0x134, "PGOTRAIN", 8);
+        rom[0x147] = 0x01;      // MBC1
+        rom[0x148] = 0x00;      // 32 KB
+        rom[0x149] = 0x00;      // No RAM
+
+        // DI, LD SP,FFFE, wait for VBlank then turn the LCD off
+        pc = 0x150;
+        emit(4, 0xF3, 0x31, 0xFE, 0xFF);
+        loop = pc;
+        emit(4, 0xF0, 0x44, 0xFE, 0x90);
+        jr_back(0x20, loop);
+        emit(3, 0xAF, 0xE0, 0x40);
+
+        // Tile data at 8000-97FF, L xor H
+        emit(6, 0x21, 0x00, 0x80, 0x01, 0x00, 0x18);
+        loop = pc;
+        emit(6, 0x7D, 0xAC, 0x22, 0x0B, 0x78, 0xB1);
+        jr_back(0x20, loop);
+
+        // Tile map at 9800, L and 3F
+        emit(3, 0x01, 0x00, 0x04);
+        loop = pc;
+        emit(7, 0x7D, 0xE6, 0x3F, 0x22, 0x0B, 0x78, 0xB1);
+        jr_back(0x20, loop);
+
+        // Sprite table at C100, then OAM DMA from it
+        emit(5, 0x21, 0x00, 0xC1, 0x06, 0xA0);
+        loop = pc;
+        emit(3, 0x7D, 0x22, 0x05);
+        jr_back(0x20, loop);
+        // The bus is held during DMA, so the wait runs from HRAM: LDH (46),A,
+        // LD A,28, DEC A, JR NZ back to the DEC, RET
+        uint8_t dma_wait[] = {0xE0, 0x46, 0x3E, 0x28, 0x3D, 0x20, 0xFD, 0xC9};
+        for (int i = 0; i < (int) sizeof(dma_wait); i++) {
+                write_io(0x80 + i, dma_wait[i]);
+        }
+        emit(5, 0x3E, 0xC1, 0xCD, 0x80, 0xFF);
+
+        // Palettes, LCD on with sprites, sound on
+        write_io(0x47, 0xE4);
+        write_io(0x48, 0xD2);
+        write_io(0x40, 0x93);
+        write_io(0x26, 0x80);
+        write_io(0x25, 0xFF);
+        write_io(0x24, 0x77);
+        write_io(0x11, 0x80);
+        write_io(0x12, 0xF3);
+        write_io(0x13, 0x83);
+        write_io(0x14, 0x87);
+        write_io(0x21, 0xF1);
+        write_io(0x22, 0x55);
+        write_io(0x23, 0x80);
+
+        // VBlank interrupt only, EI
+        write_io(0xFF, 0x01);
+        emit(1, 0xFB);
+
+        // Main loop: HALT, CALL work, retrigger channel 1 at a new pitch
+        int main_loop = pc;
+        emit(1, 0x76);
+        int call = pc;
+        emit(3, 0xCD, 0x00, 0x00);
+        emit(6, 0xFA, 0x00, 0xC0, 0xE0, 0x13, 0x00);
+        write_io(0x14, 0x86);
+        write_io(0x23, 0x80);
+        jr_back(0x18, main_loop);
+
+        int work = pc;
+        rom[call + 1] = work & 0xFF;
+        rom[call + 2] = work >> 8;
+        emit(3, 0xC5, 0xE5, 0xD5);
+
+        // Mix 64 bytes at C200: ADD, SWAP
+        emit(5, 0x21, 0x00, 0xC2, 0x06, 0x40);
+        loop = pc;
+        emit(6, 0x7E, 0x80, 0xCB, 0x37, 0x22, 0x05);
+        jr_back(0x20, loop);
+
+        // 128 bytes at C300 through BIT, SRL, RL, XOR, ADC, SUB, AND
+        emit(5, 0x21, 0x00, 0xC3, 0x06, 0x80);
+        loop = pc;
+        emit(3, 0x7E, 0xCB, 0x47);
+        emit(2, 0x28, 0x02);            // JR Z past the SRL
+        emit(2, 0xCB, 0x3F);
+        emit(2, 0xCB, 0x11);
+        emit(8, 0xA9, 0x8A, 0x93, 0xE6, 0x7F, 0x22, 0x13, 0x05);
+        jr_back(0x20, loop);
+
+        // Select bank 1 and copy 64 bytes from 4000 to C400
+        emit(5, 0x3E, 0x01, 0xEA, 0x00, 0x20);
+        emit(8, 0x21, 0x00, 0x40, 0x11, 0x00, 0xC4, 0x06, 0x40);
+        loop = pc;
+        emit(4, 0x2A, 0x12, 0x13, 0x05);
+        jr_back(0x20, loop);
+        emit(1, 0x19);
+
+        // Poll the joypad and return
+        write_io(0x00, 0x20);
+        emit(2, 0xF0, 0x00);
+        emit(4, 0xD1, 0xE1, 0xC1, 0xC9);
+
+        // Bank 1 data
+        for (int i = 0x4000; i < 0x8000; i++) {
+                rom[i] = i * 7;
+        }
+
+        // Header and global checksums
+        uint8_t header = 0;
+        for (int i = 0x134; i <= 0x14C; i++) {
+                header = header - rom[i] - 1;
+        }
+        rom[0x14D] = header;
+        uint16_t global = 0;
+        for (int i = 0; i < 0x8000; i++) {
+                if (i != 0x14E && i != 0x14F) {
+                        global += rom[i];
+                }
+        }
+        rom[0x14E] = global >> 8;
+        rom[0x14F] = global & 0xFF;
+
+        fwrite(rom, 1, sizeof(rom), stdout);
+        return 0;
+}